@@ -0,0 +1,450 @@
+/* -*- c-basic-offset: 4 -*- */
+/*
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include <QtTest>
+#include <QObject>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <webcalclient.h>
+#include <feedrecord.h>
+
+#include "feedserver.h"
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#include <cerrno>
+#include <atomic>
+
+/* Heap allocations of the whole process are counted by wrapping
+ * the allocator of the C library, Qt containers use it directly.
+ */
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void *__libc_memalign(size_t alignment, size_t size);
+extern "C" void *__libc_valloc(size_t size);
+extern "C" void *__libc_pvalloc(size_t size);
+extern "C" void __libc_free(void *ptr);
+
+static std::atomic<qint64> allocationCount(0);
+static std::atomic<qint64> heapBytes(0);
+static std::atomic<qint64> peakHeapBytes(0);
+
+static void *counted(void *ptr)
+{
+    if (ptr) {
+        allocationCount += 1;
+        const qint64 size = heapBytes += qint64(malloc_usable_size(ptr));
+        qint64 peak = peakHeapBytes.load();
+        while (size > peak && !peakHeapBytes.compare_exchange_weak(peak, size)) {
+        }
+    }
+    return ptr;
+}
+
+static void released(void *ptr)
+{
+    if (ptr) {
+        heapBytes -= qint64(malloc_usable_size(ptr));
+    }
+}
+
+extern "C" void *malloc(size_t size)
+{
+    return counted(__libc_malloc(size));
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    return counted(__libc_calloc(count, size));
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    const qint64 previous = ptr ? qint64(malloc_usable_size(ptr)) : 0;
+    void *result = __libc_realloc(ptr, size);
+    if (result || !size) {
+        heapBytes -= previous;
+        return counted(result);
+    }
+    return result;
+}
+
+extern "C" void *memalign(size_t alignment, size_t size)
+{
+    return counted(__libc_memalign(alignment, size));
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size)
+{
+    return counted(__libc_memalign(alignment, size));
+}
+
+extern "C" int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+    *ptr = counted(__libc_memalign(alignment, size));
+    return *ptr || !size ? 0 : ENOMEM;
+}
+
+extern "C" void *valloc(size_t size)
+{
+    return counted(__libc_valloc(size));
+}
+
+extern "C" void *pvalloc(size_t size)
+{
+    return counted(__libc_pvalloc(size));
+}
+
+extern "C" void free(void *ptr)
+{
+    released(ptr);
+    __libc_free(ptr);
+}
+#endif
+
+/* Benchmarks of WebCalClient::processData() on generated feeds,
+ * and of complete synchronisations served by a local FeedServer.
+ *
+ * The feeds are configured with environment variables:
+ * - WEBCAL_BENCH_EVENTS: number of events (default 2000),
+ * - WEBCAL_BENCH_RECURRENCES: ratio of recurring events (default 0.2),
+ * - WEBCAL_BENCH_TIMEZONES: number of time zones (default 4),
+ * - WEBCAL_BENCH_CHANGES: ratio of events modified in the small delta
+ *   (default 0.05),
+ * - WEBCAL_BENCH_OUTPUT: JSON file where results are written
+ *   (default bench_webcalclient.json).
+ *
+ * With the GNU C library, the number of heap allocations and the
+ * peak of heap usage of each scenario are reported too.
+ *
+ * Each scenario runs twice, in its own profile: with the strings of
+ * parsed incidences interned, and without, see WEBCAL_STRING_POOL
+ * in IcsStreamParser.
+ */
+class bench_WebCalClient : public QObject
+{
+    Q_OBJECT
+
+public:
+    bench_WebCalClient();
+
+private slots:
+    void initTestCase_data();
+    void initTestCase();
+    void cleanupTestCase();
+
+    void firstDownload();
+    void unchangedEtag();
+    void smallDelta();
+    void fullReplace();
+    void networkDownload();
+    void networkNotModified();
+    void networkNotModifiedWithoutRecord();
+
+private:
+    struct Measure {
+        qint64 rss;
+        qint64 writtenBytes;
+        qint64 writeCalls;
+        qint64 allocations;
+        qint64 heap;
+    };
+    static Measure measure();
+    static QString profileName();
+    static qint64 procValue(const QString &path, const QByteArray &key);
+
+    QByteArray generateFeed(const QByteArray &uidPrefix, int revision) const;
+    void run(const QString &name, const QByteArray &icsData, const QByteArray &etag,
+             bool network = false);
+
+    int mEvents;
+    double mRecurrences;
+    int mTimezones;
+    double mChanges;
+    QString mOutput;
+    QJsonArray mResults;
+    FeedServer mServer;
+};
+
+static double envDouble(const char *name, double defaultValue)
+{
+    bool ok = false;
+    const double value = qgetenv(name).toDouble(&ok);
+    return ok ? value : defaultValue;
+}
+
+bench_WebCalClient::bench_WebCalClient()
+    : mEvents(int(envDouble("WEBCAL_BENCH_EVENTS", 2000)))
+    , mRecurrences(envDouble("WEBCAL_BENCH_RECURRENCES", 0.2))
+    , mTimezones(qMax(1, int(envDouble("WEBCAL_BENCH_TIMEZONES", 4))))
+    , mChanges(envDouble("WEBCAL_BENCH_CHANGES", 0.05))
+    , mOutput(qEnvironmentVariableIsEmpty("WEBCAL_BENCH_OUTPUT")
+              ? QStringLiteral("bench_webcalclient.json")
+              : QString::fromLocal8Bit(qgetenv("WEBCAL_BENCH_OUTPUT")))
+{
+}
+
+void bench_WebCalClient::initTestCase_data()
+{
+    QTest::addColumn<bool>("interning");
+    QTest::newRow("interned") << true;
+    QTest::newRow("uninterned") << false;
+}
+
+QString bench_WebCalClient::profileName()
+{
+    QFETCH_GLOBAL(bool, interning);
+    return interning ? QStringLiteral("webcal-benchmark")
+                     : QStringLiteral("webcal-benchmark-uninterned");
+}
+
+void bench_WebCalClient::initTestCase()
+{
+    qputenv("SQLITESTORAGEDB", "./bench-db");
+    qputenv("XDG_CACHE_HOME", "./bench-cache");
+
+    QFile::remove("./bench-db");
+    QDir("./bench-cache").removeRecursively();
+
+    QVERIFY(mServer.start());
+}
+
+void bench_WebCalClient::cleanupTestCase()
+{
+    for (const QString &name : {QStringLiteral("webcal-benchmark"),
+                                QStringLiteral("webcal-benchmark-uninterned")}) {
+        Buteo::SyncProfile webcal(name);
+        webcal.merge(Buteo::Profile(QStringLiteral("webcal"), Buteo::Profile::TYPE_CLIENT));
+        WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+        QVERIFY(client.init());
+        QVERIFY(client.cleanUp());
+        webcal.clientProfile()->setKey(QStringLiteral("remoteCalendar"),
+                                       mServer.url(QStringLiteral("/benchmark.ics")));
+        WebCalClient networkClient(QStringLiteral("webcal"), webcal, 0);
+        QVERIFY(networkClient.init());
+        QVERIFY(networkClient.cleanUp());
+    }
+
+    QJsonObject parameters;
+    parameters.insert(QStringLiteral("events"), mEvents);
+    parameters.insert(QStringLiteral("recurrences"), mRecurrences);
+    parameters.insert(QStringLiteral("timezones"), mTimezones);
+    parameters.insert(QStringLiteral("changes"), mChanges);
+    QJsonObject root;
+    root.insert(QStringLiteral("parameters"), parameters);
+    root.insert(QStringLiteral("results"), mResults);
+
+    QFile output(mOutput);
+    QVERIFY(output.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    output.write(QJsonDocument(root).toJson());
+}
+
+qint64 bench_WebCalClient::procValue(const QString &path, const QByteArray &key)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+    for (const QByteArray &line : file.readAll().split('\n')) {
+        if (line.startsWith(key + ':')) {
+            // Values of /proc/self/status are in kB.
+            const QByteArray value = line.mid(key.size() + 1).trimmed();
+            return value.endsWith(" kB") ? value.left(value.size() - 3).toLongLong() * 1024
+                                         : value.toLongLong();
+        }
+    }
+    return -1;
+}
+
+bench_WebCalClient::Measure bench_WebCalClient::measure()
+{
+#ifdef __GLIBC__
+    const qint64 allocations = allocationCount.load();
+    const qint64 heap = heapBytes.load();
+#else
+    const qint64 allocations = -1;
+    const qint64 heap = -1;
+#endif
+    return Measure{procValue(QStringLiteral("/proc/self/status"), "VmHWM"),
+                   procValue(QStringLiteral("/proc/self/io"), "write_bytes"),
+                   procValue(QStringLiteral("/proc/self/io"), "syscw"),
+                   allocations, heap};
+}
+
+QByteArray bench_WebCalClient::generateFeed(const QByteArray &uidPrefix, int revision) const
+{
+    const QDateTime start(QDate::currentDate().addDays(-mEvents / 20), QTime(8, 0));
+    const int changeStep = mChanges > 0. ? qMax(1, int(1. / mChanges)) : 0;
+    const int recurrenceStep = mRecurrences > 0. ? qMax(1, int(1. / mRecurrences)) : 0;
+
+    QByteArray data("BEGIN:VCALENDAR\r\nVERSION:2.0\r\nPRODID:-//webcal//benchmark//EN\r\n"
+                    "X-WR-CALNAME:Benchmark\r\n");
+    for (int tz = 0; tz < mTimezones; tz++) {
+        const QByteArray offset = QByteArray::number(tz % 12).rightJustified(2, '0');
+        data += "BEGIN:VTIMEZONE\r\nTZID:Benchmark/Zone-" + QByteArray::number(tz) + "\r\n"
+            "BEGIN:STANDARD\r\nDTSTART:19700101T000000\r\n"
+            "TZOFFSETFROM:+" + offset + "00\r\nTZOFFSETTO:+" + offset + "00\r\n"
+            "END:STANDARD\r\nEND:VTIMEZONE\r\n";
+    }
+    for (int i = 0; i < mEvents; i++) {
+        const int version = (changeStep && i % changeStep == 0) ? revision : 0;
+        const QDateTime dtStart = start.addSecs(qint64(i) * 3 * 3600);
+        data += "BEGIN:VEVENT\r\nUID:" + uidPrefix + QByteArray::number(i) + "@benchmark\r\n"
+            "DTSTAMP:20210101T000000Z\r\n"
+            "SEQUENCE:" + QByteArray::number(version) + "\r\n"
+            "DTSTART;TZID=Benchmark/Zone-" + QByteArray::number(i % mTimezones) + ":"
+            + dtStart.toString(QStringLiteral("yyyyMMdd'T'hhmmss")).toLatin1() + "\r\n"
+            "DURATION:PT1H\r\n"
+            "SUMMARY:Event " + QByteArray::number(i) + " version " + QByteArray::number(version) + "\r\n"
+            "LOCATION:Room " + QByteArray::number(i % 50) + "\r\n"
+            "ORGANIZER;CN=Organizer " + QByteArray::number(i % 5) + ":mailto:organizer"
+            + QByteArray::number(i % 5) + "@example.org\r\n"
+            "CATEGORIES:Benchmark,Group " + QByteArray::number(i % 7) + "\r\n"
+            "DESCRIPTION:Generated event used to measure the synchronisation cost.\r\n";
+        if (recurrenceStep && i % recurrenceStep == 0) {
+            data += "RRULE:FREQ=WEEKLY;COUNT=52\r\n";
+        }
+        data += "END:VEVENT\r\n";
+    }
+    data += "END:VCALENDAR\r\n";
+    return data;
+}
+
+void bench_WebCalClient::run(const QString &name, const QByteArray &icsData, const QByteArray &etag,
+                             bool network)
+{
+    // Reset the peak RSS, supported since Linux 4.0.
+    QFile clearRefs(QStringLiteral("/proc/self/clear_refs"));
+    if (clearRefs.open(QIODevice::WriteOnly)) {
+        clearRefs.write("5");
+        clearRefs.close();
+    }
+
+    QFETCH_GLOBAL(bool, interning);
+    qputenv("WEBCAL_STRING_POOL", interning ? "1" : "0");
+
+    Buteo::SyncProfile webcal(profileName());
+    webcal.merge(Buteo::Profile(QStringLiteral("webcal"), Buteo::Profile::TYPE_CLIENT));
+    if (network) {
+        mServer.setFeed(QStringLiteral("/benchmark.ics"), icsData, etag, QByteArray(),
+                        FeedServer::Chunked | FeedServer::Gzip);
+        webcal.clientProfile()->setKey(QStringLiteral("remoteCalendar"),
+                                       mServer.url(QStringLiteral("/benchmark.ics")));
+    }
+    WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+    QSignalSpy success(&client, &WebCalClient::success);
+    QSignalSpy error(&client, &WebCalClient::error);
+
+#ifdef __GLIBC__
+    peakHeapBytes = heapBytes.load();
+#endif
+    const Measure before = measure();
+    QElapsedTimer timer;
+    timer.start();
+    bool recorded = false;
+    QBENCHMARK_ONCE {
+        QVERIFY(client.init());
+        // Storage is left closed when the feeds are known from the record.
+        recorded = !client.mStorage;
+        if (network) {
+            QVERIFY(client.startSync());
+            QTRY_COMPARE_WITH_TIMEOUT(success.count() + error.count(), 1, 600000);
+        } else {
+            client.processData(client.mFeeds.first(), icsData, etag);
+            client.commit();
+        }
+    }
+    const qint64 elapsed = timer.elapsed();
+    const Measure after = measure();
+
+    const Buteo::SyncResults res(client.getSyncResults());
+    QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+    Buteo::ItemCounts counts;
+    if (!res.targetResults().isEmpty()) {
+        counts = res.targetResults().first().localItems();
+    }
+
+    QJsonObject result;
+    result.insert(QStringLiteral("name"), name);
+    result.insert(QStringLiteral("interning"), interning);
+    result.insert(QStringLiteral("bytes"), icsData.size());
+    result.insert(QStringLiteral("wallTimeMs"), elapsed);
+    result.insert(QStringLiteral("recorded"), recorded);
+    if (network) {
+        const qint64 transferred = client.mFeeds.first()->transferredBytes;
+        result.insert(QStringLiteral("transferredBytes"), transferred);
+        result.insert(QStringLiteral("throughputBytesPerSecond"),
+                      elapsed > 0 ? double(transferred) * 1000. / elapsed : 0.);
+    }
+    result.insert(QStringLiteral("peakRssBytes"), after.rss);
+    result.insert(QStringLiteral("writtenBytes"), after.writtenBytes - before.writtenBytes);
+    result.insert(QStringLiteral("writeCalls"), after.writeCalls - before.writeCalls);
+#ifdef __GLIBC__
+    result.insert(QStringLiteral("allocations"), after.allocations - before.allocations);
+    result.insert(QStringLiteral("peakHeapBytes"), peakHeapBytes.load() - before.heap);
+#endif
+    result.insert(QStringLiteral("added"), int(counts.added));
+    result.insert(QStringLiteral("modified"), int(counts.modified));
+    result.insert(QStringLiteral("deleted"), int(counts.deleted));
+    mResults.append(result);
+}
+
+void bench_WebCalClient::firstDownload()
+{
+    run(QStringLiteral("firstDownload"), generateFeed("event-", 0), "\"etag-0\"");
+}
+
+void bench_WebCalClient::unchangedEtag()
+{
+    run(QStringLiteral("unchangedEtag"), generateFeed("event-", 0), "\"etag-0\"");
+}
+
+void bench_WebCalClient::smallDelta()
+{
+    run(QStringLiteral("smallDelta"), generateFeed("event-", 1), "\"etag-1\"");
+}
+
+void bench_WebCalClient::fullReplace()
+{
+    run(QStringLiteral("fullReplace"), generateFeed("replaced-", 2), "\"etag-2\"");
+}
+
+void bench_WebCalClient::networkDownload()
+{
+    run(QStringLiteral("networkDownload"), generateFeed("network-", 0), "\"etag-network\"", true);
+}
+
+void bench_WebCalClient::networkNotModified()
+{
+    run(QStringLiteral("networkNotModified"), generateFeed("network-", 0), "\"etag-network\"", true);
+}
+
+void bench_WebCalClient::networkNotModifiedWithoutRecord()
+{
+    // Same poll, with init() looking up the notebooks in storage.
+    FeedRecord::remove(profileName());
+    run(QStringLiteral("networkNotModifiedWithoutRecord"), generateFeed("network-", 0),
+        "\"etag-network\"", true);
+}
+
+#include "bench_webcalclient.moc"
+QTEST_MAIN(bench_WebCalClient)
@@ -0,0 +1,18 @@
+TEMPLATE = app
+TARGET = bench_webcalclient
+
+QT += testlib
+CONFIG += release
+
+include($$PWD/../src/src.pri)
+
+INCLUDEPATH += $$PWD/../tests
+
+SOURCES += bench_webcalclient.cpp \
+        $$PWD/../tests/feedserver.cpp
+
+HEADERS += $$PWD/../tests/feedserver.h
+
+target.path = /opt/tests/buteo/plugins/webcal/
+
+INSTALLS += target
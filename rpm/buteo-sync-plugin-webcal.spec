@@ -5,13 +5,21 @@ Release:    1
 License:    LGPLv2+
 URL:        https://git.sailfishos.org/mer-core/buteo-sync-plugin-webcal
 Source0:    %{name}-%{version}.tar.bz2
+# Decoding of brotli compressed feeds, build with --without brotli
+# to only accept gzip and deflate.
+%bcond_without brotli
 BuildRequires:  pkgconfig(Qt5Core)
 BuildRequires:  pkgconfig(Qt5Network)
+BuildRequires:  pkgconfig(Qt5Concurrent)
 BuildRequires:  pkgconfig(Qt5DBus)
 BuildRequires:  pkgconfig(Qt5Test)
 BuildRequires:  pkgconfig(libmkcal-qt5) >= 0.6.10
 BuildRequires:  pkgconfig(KF5CalendarCore)
 BuildRequires:  pkgconfig(buteosyncfw5) >= 0.10.0
+BuildRequires:  pkgconfig(zlib)
+%if %{with brotli}
+BuildRequires:  pkgconfig(libbrotlidec)
+%endif
 Requires: buteo-syncfw-qt5-msyncd
 
 %description
@@ -29,7 +37,8 @@ Summary:  Unit tests for web calendar Buteo sync plugin
 Requires:   %{name} = %{version}
 
 %description tests
-This package contains unit tests for web calendar Buteo sync plugin
+This package contains unit tests and benchmarks for web calendar
+Buteo sync plugin
 
 %files tests
 %defattr(-,root,root,-)
@@ -39,7 +48,7 @@ This package contains unit tests for web calendar Buteo sync plugin
 %autosetup -n %{name}-%{version}
 
 %build
-%qmake5
+%qmake5 %{!?with_brotli:CONFIG+=no_brotli}
 %make_build
 
 %install
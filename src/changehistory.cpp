@@ -0,0 +1,132 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "changehistory.h"
+
+#include <QLocale>
+#include <QStringList>
+
+static const int MAX_ENTRIES = 16;
+static const qint64 MIN_INTERVAL = 3600;
+static const qint64 DEFAULT_INTERVAL = 86400;
+static const qint64 MAX_INTERVAL = 7 * 86400;
+static const int MAX_BACKOFF = 4;
+
+static const char OUTCOMES[] = {'c', 'u', 'f'};
+
+ChangeHistory::ChangeHistory(const QString &history)
+{
+    for (const QString &item : history.split(QLatin1Char(' '), QString::SkipEmptyParts)) {
+        const int sep = item.indexOf(QLatin1Char(':'));
+        bool ok = false;
+        const qint64 time = item.left(sep).toLongLong(&ok);
+        const QString outcome = item.mid(sep + 1);
+        if (sep > 0 && ok && outcome.size() == 1) {
+            for (int i = Changed; i <= Failed; i++) {
+                if (outcome[0] == QLatin1Char(OUTCOMES[i])) {
+                    mEntries.append(Entry{time, Outcome(i)});
+                }
+            }
+        }
+    }
+}
+
+QString ChangeHistory::toString() const
+{
+    QStringList items;
+    for (const Entry &entry : mEntries) {
+        items << QString::number(entry.time) + QLatin1Char(':') + QLatin1Char(OUTCOMES[entry.outcome]);
+    }
+    return items.join(QLatin1Char(' '));
+}
+
+void ChangeHistory::record(Outcome outcome, const QDateTime &when)
+{
+    mEntries.append(Entry{when.toMSecsSinceEpoch() / 1000, outcome});
+    while (mEntries.size() > MAX_ENTRIES) {
+        mEntries.removeFirst();
+    }
+}
+
+qint64 ChangeHistory::recommendedInterval(qint64 cacheLifetime) const
+{
+    // Poll about twice per observed change period.
+    qint64 interval = DEFAULT_INTERVAL;
+    qint64 first = -1;
+    qint64 last = -1;
+    int changes = 0;
+    for (const Entry &entry : mEntries) {
+        if (entry.outcome == Changed) {
+            first = first < 0 ? entry.time : first;
+            last = entry.time;
+            changes += 1;
+        }
+    }
+    if (changes > 1) {
+        interval = (last - first) / (changes - 1) / 2;
+    }
+
+    // Back off while the feed is unchanged or failing.
+    int streak = 0;
+    for (int i = mEntries.size() - 1; i >= 0 && mEntries[i].outcome != Changed; i--) {
+        streak += 1;
+    }
+    interval <<= qMin(streak, MAX_BACKOFF);
+
+    // No need to ask before the server content expires.
+    interval = qMax(interval, cacheLifetime);
+
+    return qBound(MIN_INTERVAL, interval, MAX_INTERVAL);
+}
+
+static QDateTime httpDate(const QByteArray &value)
+{
+    QDateTime date = QLocale::c().toDateTime(QString::fromLatin1(value.trimmed()),
+                                             QStringLiteral("ddd, dd MMM yyyy hh:mm:ss 'GMT'"));
+    date.setTimeSpec(Qt::UTC);
+    return date;
+}
+
+qint64 ChangeHistory::cacheLifetime(const QByteArray &cacheControl, const QByteArray &expires,
+                                    const QByteArray &date)
+{
+    for (const QByteArray &directive : cacheControl.split(',')) {
+        const QByteArray token = directive.trimmed().toLower();
+        if (token == "no-cache" || token == "no-store") {
+            return -1;
+        } else if (token.startsWith("max-age=")) {
+            bool ok = false;
+            const qint64 maxAge = token.mid(8).toLongLong(&ok);
+            if (ok) {
+                return maxAge;
+            }
+        }
+    }
+    const QDateTime expiration = httpDate(expires);
+    if (expiration.isValid()) {
+        QDateTime reference = httpDate(date);
+        if (!reference.isValid()) {
+            reference = QDateTime::currentDateTimeUtc();
+        }
+        return qMax(qint64(0), reference.secsTo(expiration));
+    }
+    return -1;
+}
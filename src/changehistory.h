@@ -0,0 +1,76 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef CHANGEHISTORY_H
+#define CHANGEHISTORY_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QList>
+#include <QString>
+
+/*! \brief Outcomes of the last syncs of a feed
+ *
+ * The history records when a feed changed, was unchanged or failed,
+ * and is used to recommend the interval until the next sync: feeds
+ * are polled more often when they change often, less when they do
+ * not change or keep failing, and never before the lifetime given by
+ * the server caching headers.
+ */
+class ChangeHistory
+{
+public:
+    enum Outcome {
+        Changed,
+        Unchanged,
+        Failed
+    };
+
+    /*! \brief Restores a history saved with toString() */
+    explicit ChangeHistory(const QString &history = QString());
+
+    /*! \brief Serialised history, to be stored in a notebook property */
+    QString toString() const;
+
+    /*! \brief Adds the outcome of a sync, dropping the oldest ones */
+    void record(Outcome outcome, const QDateTime &when = QDateTime::currentDateTimeUtc());
+
+    /*! \brief Recommended interval until next sync, in seconds
+     *
+     * @param cacheLifetime freshness lifetime given by the server,
+     *        in seconds, or -1 if unknown
+     */
+    qint64 recommendedInterval(qint64 cacheLifetime = -1) const;
+
+    /*! \brief Freshness lifetime in seconds, from Cache-Control max-age
+     *  or from Expires, or -1 if the response gives none */
+    static qint64 cacheLifetime(const QByteArray &cacheControl, const QByteArray &expires,
+                                const QByteArray &date);
+
+private:
+    struct Entry {
+        qint64 time;
+        Outcome outcome;
+    };
+    QList<Entry> mEntries;
+};
+
+#endif // CHANGEHISTORY_H
@@ -0,0 +1,120 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "componentindex.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QLoggingCategory>
+
+Q_DECLARE_LOGGING_CATEGORY(lcWebCal)
+
+static const quint32 INDEX_MAGIC = 0x57434349; // WCCI
+static const quint32 INDEX_VERSION = 1;
+
+ComponentIndex::ComponentIndex()
+{
+}
+
+QString ComponentIndex::path(const QString &notebookUid)
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+        + QStringLiteral("/webcal/") + notebookUid + QStringLiteral(".components");
+}
+
+void ComponentIndex::remove(const QString &notebookUid)
+{
+    QFile::remove(path(notebookUid));
+}
+
+QByteArray ComponentIndex::key(const QByteArray &uid, const QByteArray &recurrenceId)
+{
+    return recurrenceId.isEmpty() ? uid : uid + '\n' + recurrenceId;
+}
+
+bool ComponentIndex::load(const QString &notebookUid)
+{
+    mFingerprints.clear();
+
+    QFile file(path(notebookUid));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+    quint32 magic, version;
+    stream >> magic >> version;
+    if (magic != INDEX_MAGIC || version != INDEX_VERSION) {
+        return false;
+    }
+    stream >> mFingerprints;
+    if (stream.status() != QDataStream::Ok) {
+        qCWarning(lcWebCal) << "Corrupted component index" << file.fileName();
+        mFingerprints.clear();
+        return false;
+    }
+    return true;
+}
+
+bool ComponentIndex::save(const QString &notebookUid) const
+{
+    const QString filePath = path(notebookUid);
+    QDir().mkpath(QFileInfo(filePath).absolutePath());
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(lcWebCal) << "Cannot write component index" << filePath;
+        return false;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream << INDEX_MAGIC << INDEX_VERSION << mFingerprints;
+    return file.commit();
+}
+
+bool ComponentIndex::contains(const QByteArray &key, const QByteArray &fingerprint) const
+{
+    QHash<QByteArray, QByteArray>::ConstIterator it = mFingerprints.constFind(key);
+    return it != mFingerprints.constEnd() && it.value() == fingerprint;
+}
+
+void ComponentIndex::insert(const QByteArray &key, const QByteArray &fingerprint)
+{
+    mFingerprints.insert(key, fingerprint);
+}
+
+QHash<QByteArray, QByteArray> ComponentIndex::fingerprints() const
+{
+    return mFingerprints;
+}
+
+int ComponentIndex::count() const
+{
+    return mFingerprints.count();
+}
+
+bool ComponentIndex::isEmpty() const
+{
+    return mFingerprints.isEmpty();
+}
@@ -0,0 +1,80 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef COMPONENTINDEX_H
+#define COMPONENTINDEX_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+
+/*! \brief Fingerprints of the raw components stored in a notebook
+ *
+ * Top-level components of a feed are keyed by their UID and their
+ * RECURRENCE-ID property, as written in the feed. The fingerprint of
+ * their raw data is the one given to the incidences parsed from them,
+ * see IcsStreamParser::fingerprint(). The index is kept in a sidecar
+ * file per notebook, so the next sync can skip the components that
+ * did not change without parsing them.
+ */
+class ComponentIndex
+{
+public:
+    ComponentIndex();
+
+    /*! \brief Path of the index of a notebook */
+    static QString path(const QString &notebookUid);
+
+    /*! \brief Deletes the index of a notebook */
+    static void remove(const QString &notebookUid);
+
+    /*! \brief Key of a component
+     *
+     * @param uid value of the UID property
+     * @param recurrenceId the RECURRENCE-ID content line, empty if none
+     */
+    static QByteArray key(const QByteArray &uid, const QByteArray &recurrenceId);
+
+    /*! \brief Loads the index of a notebook */
+    bool load(const QString &notebookUid);
+
+    /*! \brief Saves the index for a notebook */
+    bool save(const QString &notebookUid) const;
+
+    /*! \brief Checks if a component is known with this fingerprint */
+    bool contains(const QByteArray &key, const QByteArray &fingerprint) const;
+
+    /*! \brief Adds or updates the fingerprint of a component */
+    void insert(const QByteArray &key, const QByteArray &fingerprint);
+
+    /*! \brief Fingerprints by component keys */
+    QHash<QByteArray, QByteArray> fingerprints() const;
+
+    /*! \brief Number of indexed components */
+    int count() const;
+
+    bool isEmpty() const;
+
+private:
+    QHash<QByteArray, QByteArray> mFingerprints;
+};
+
+#endif // COMPONENTINDEX_H
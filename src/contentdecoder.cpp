@@ -0,0 +1,238 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "contentdecoder.h"
+
+#include <QLoggingCategory>
+
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+#include <brotli/decode.h>
+#endif
+
+Q_DECLARE_LOGGING_CATEGORY(lcWebCal)
+
+static const int CHUNK_SIZE = 16384;
+
+// Room for the next decoded chunk, up to one byte past the limit,
+// enough to tell it is exceeded.
+static int chunkSize(qint64 limit, qint64 decoded)
+{
+    return limit < 0 ? CHUNK_SIZE : int(qMin<qint64>(CHUNK_SIZE, limit - decoded + 1));
+}
+
+QByteArray ContentDecoder::acceptedEncodings()
+{
+#ifdef HAVE_BROTLI
+    return QByteArray("br, gzip, deflate");
+#else
+    return QByteArray("gzip, deflate");
+#endif
+}
+
+ContentDecoder::ContentDecoder(const QByteArray &contentEncoding)
+    : mEncoding(Unsupported)
+    , mState(nullptr)
+    , mRawDeflate(false)
+    , mEnded(false)
+    , mEncodedBytes(0)
+    , mDecodedBytes(0)
+{
+    const QByteArray encoding = contentEncoding.trimmed().toLower();
+    if (encoding.isEmpty() || encoding == "identity") {
+        mEncoding = Identity;
+    } else if (encoding == "gzip" || encoding == "x-gzip" || encoding == "deflate") {
+        z_stream *stream = new z_stream;
+        stream->zalloc = Z_NULL;
+        stream->zfree = Z_NULL;
+        stream->opaque = Z_NULL;
+        stream->avail_in = 0;
+        stream->next_in = Z_NULL;
+        // Detect zlib or gzip headers automatically.
+        if (inflateInit2(stream, MAX_WBITS + 32) == Z_OK) {
+            mEncoding = Zlib;
+            mState = stream;
+        } else {
+            delete stream;
+        }
+#ifdef HAVE_BROTLI
+    } else if (encoding == "br") {
+        mState = BrotliDecoderCreateInstance(nullptr, nullptr, nullptr);
+        if (mState) {
+            mEncoding = Brotli;
+        }
+#endif
+    } else {
+        qCWarning(lcWebCal) << "Unsupported content encoding" << encoding;
+    }
+}
+
+ContentDecoder::~ContentDecoder()
+{
+    if (mEncoding == Zlib) {
+        z_stream *stream = static_cast<z_stream*>(mState);
+        inflateEnd(stream);
+        delete stream;
+#ifdef HAVE_BROTLI
+    } else if (mEncoding == Brotli) {
+        BrotliDecoderDestroyInstance(static_cast<BrotliDecoderState*>(mState));
+#endif
+    }
+}
+
+bool ContentDecoder::isValid() const
+{
+    return mEncoding != Unsupported;
+}
+
+bool ContentDecoder::isIdentity() const
+{
+    return mEncoding == Identity;
+}
+
+bool ContentDecoder::decode(const QByteArray &data, QByteArray *output, qint64 limit)
+{
+    mEncodedBytes += data.size();
+    const int size = output->size();
+    bool ok = false;
+    switch (mEncoding) {
+    case Identity:
+        output->append(data);
+        ok = true;
+        break;
+    case Zlib:
+        ok = inflate(data, output, limit);
+        break;
+    case Brotli:
+        ok = unbrotli(data, output, limit);
+        break;
+    case Unsupported:
+        break;
+    }
+    mDecodedBytes += output->size() - size;
+    return ok;
+}
+
+bool ContentDecoder::finish()
+{
+    if (mEncoding == Zlib || mEncoding == Brotli) {
+        if (!mEnded) {
+            qCWarning(lcWebCal) << "Truncated encoded content.";
+        }
+        return mEnded;
+    }
+    return isValid();
+}
+
+qint64 ContentDecoder::encodedBytes() const
+{
+    return mEncodedBytes;
+}
+
+qint64 ContentDecoder::decodedBytes() const
+{
+    return mDecodedBytes;
+}
+
+bool ContentDecoder::inflate(const QByteArray &data, QByteArray *output, qint64 limit)
+{
+    z_stream *stream = static_cast<z_stream*>(mState);
+    if (!mRawDeflate && stream->total_out == 0) {
+        // Keep the beginning of the stream, in case it should be
+        // replayed as raw deflate data.
+        mHead.append(data);
+    }
+    stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData()));
+    stream->avail_in = data.size();
+    const int start = output->size();
+    while (stream->avail_in > 0 && !mEnded) {
+        const int size = output->size();
+        const int chunk = chunkSize(limit, size - start);
+        if (chunk <= 0) {
+            break;
+        }
+        output->resize(size + chunk);
+        stream->next_out = reinterpret_cast<Bytef*>(output->data() + size);
+        stream->avail_out = chunk;
+        const int ret = ::inflate(stream, Z_NO_FLUSH);
+        output->resize(size + chunk - stream->avail_out);
+        if (ret == Z_DATA_ERROR && !mRawDeflate && stream->total_out == 0) {
+            // Some servers send raw deflate data for "deflate",
+            // without the zlib header.
+            inflateEnd(stream);
+            if (inflateInit2(stream, -MAX_WBITS) != Z_OK) {
+                mEncoding = Unsupported;
+                delete stream;
+                mState = nullptr;
+                return false;
+            }
+            mRawDeflate = true;
+            const QByteArray head = mHead;
+            mHead.clear();
+            return inflate(head, output, limit);
+        } else if (ret == Z_STREAM_END) {
+            mEnded = true;
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            qCWarning(lcWebCal) << "Cannot inflate content:" << (stream->msg ? stream->msg : "");
+            return false;
+        }
+    }
+    if (stream->total_out > 0) {
+        mHead.clear();
+    }
+    return true;
+}
+
+bool ContentDecoder::unbrotli(const QByteArray &data, QByteArray *output, qint64 limit)
+{
+#ifdef HAVE_BROTLI
+    BrotliDecoderState *state = static_cast<BrotliDecoderState*>(mState);
+    size_t availableIn = data.size();
+    const uint8_t *nextIn = reinterpret_cast<const uint8_t*>(data.constData());
+    BrotliDecoderResult result = BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT;
+    const int start = output->size();
+    while (result == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT) {
+        const int size = output->size();
+        const int chunk = chunkSize(limit, size - start);
+        if (chunk <= 0) {
+            return true;
+        }
+        output->resize(size + chunk);
+        size_t availableOut = chunk;
+        uint8_t *nextOut = reinterpret_cast<uint8_t*>(output->data() + size);
+        result = BrotliDecoderDecompressStream(state, &availableIn, &nextIn,
+                                               &availableOut, &nextOut, nullptr);
+        output->resize(size + chunk - availableOut);
+    }
+    if (result == BROTLI_DECODER_RESULT_ERROR) {
+        qCWarning(lcWebCal) << "Cannot decode content:"
+                            << BrotliDecoderErrorString(BrotliDecoderGetErrorCode(state));
+        return false;
+    }
+    mEnded = (result == BROTLI_DECODER_RESULT_SUCCESS);
+    return true;
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(output);
+    Q_UNUSED(limit);
+    return false;
+#endif
+}
@@ -0,0 +1,97 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef CONTENTDECODER_H
+#define CONTENTDECODER_H
+
+#include <QByteArray>
+
+/*! \brief Streaming decoder for HTTP content encodings
+ *
+ * Supports identity, gzip and deflate, and br when built with
+ * brotli support. Encoded data are decoded chunk by chunk as they
+ * are received.
+ */
+class ContentDecoder
+{
+public:
+    /*! \brief Value for the Accept-Encoding header of requests */
+    static QByteArray acceptedEncodings();
+
+    /*! \brief Creates a decoder
+     *
+     * @param contentEncoding value of the Content-Encoding header
+     */
+    explicit ContentDecoder(const QByteArray &contentEncoding);
+    ~ContentDecoder();
+
+    /*! \brief Checks if the content encoding is supported */
+    bool isValid() const;
+
+    /*! \brief Checks if the content is not encoded
+     *
+     * Data can then be used as received, without going through decode().
+     */
+    bool isIdentity() const;
+
+    /*! \brief Decodes a chunk of data
+     *
+     * @param data encoded data
+     * @param output where decoded data are appended
+     * @param limit number of bytes this chunk may decode to, or -1
+     *        if unlimited. Decoding stops one byte past it, and the
+     *        rest of the data is dropped.
+     * @return false on corrupted data
+     */
+    bool decode(const QByteArray &data, QByteArray *output, qint64 limit = -1);
+
+    /*! \brief Checks that the encoded stream was complete */
+    bool finish();
+
+    /*! \brief Number of encoded bytes, as transferred */
+    qint64 encodedBytes() const;
+
+    /*! \brief Number of decoded bytes */
+    qint64 decodedBytes() const;
+
+private:
+    Q_DISABLE_COPY(ContentDecoder)
+
+    enum Encoding {
+        Identity,
+        Zlib,
+        Brotli,
+        Unsupported
+    };
+
+    bool inflate(const QByteArray &data, QByteArray *output, qint64 limit);
+    bool unbrotli(const QByteArray &data, QByteArray *output, qint64 limit);
+
+    Encoding mEncoding;
+    void *mState;
+    bool mRawDeflate;
+    bool mEnded;
+    QByteArray mHead;
+    qint64 mEncodedBytes;
+    qint64 mDecodedBytes;
+};
+
+#endif // CONTENTDECODER_H
@@ -0,0 +1,165 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "downloadspool.h"
+
+#include <QDir>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QLoggingCategory>
+
+Q_DECLARE_LOGGING_CATEGORY(lcWebCal)
+
+static const qint64 REPLAY_CHUNK_SIZE = 65536;
+
+DownloadSpool::DownloadSpool(const QString &notebookUid)
+    : mFile(directory() + QLatin1Char('/') + notebookUid + QStringLiteral(".part"))
+    , mInfoPath(directory() + QLatin1Char('/') + notebookUid + QStringLiteral(".info"))
+{
+    if (QFile::exists(mInfoPath)) {
+        QSettings info(mInfoPath, QSettings::IniFormat);
+        mValidator = info.value(QStringLiteral("validator")).toByteArray();
+        mContentEncoding = info.value(QStringLiteral("encoding")).toByteArray();
+    }
+}
+
+QString DownloadSpool::directory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+        + QStringLiteral("/webcal");
+}
+
+bool DownloadSpool::isResumable() const
+{
+    return !mValidator.isEmpty() && size() > 0;
+}
+
+qint64 DownloadSpool::size() const
+{
+    return mFile.size();
+}
+
+QByteArray DownloadSpool::validator() const
+{
+    return mValidator;
+}
+
+QByteArray DownloadSpool::contentEncoding() const
+{
+    return mContentEncoding;
+}
+
+bool DownloadSpool::start(const QByteArray &validator, const QByteArray &contentEncoding)
+{
+    remove();
+    if (!QDir().mkpath(directory())) {
+        qCWarning(lcWebCal) << "Cannot create spool directory" << directory();
+        return false;
+    }
+    {
+        QSettings info(mInfoPath, QSettings::IniFormat);
+        info.setValue(QStringLiteral("validator"), validator);
+        info.setValue(QStringLiteral("encoding"), contentEncoding);
+        info.sync();
+        if (info.status() != QSettings::NoError) {
+            qCWarning(lcWebCal) << "Cannot write spool information" << mInfoPath;
+            return false;
+        }
+    }
+    if (!mFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qCWarning(lcWebCal) << "Cannot open spool file" << mFile.fileName();
+        QFile::remove(mInfoPath);
+        return false;
+    }
+    mValidator = validator;
+    mContentEncoding = contentEncoding;
+    return true;
+}
+
+bool DownloadSpool::resume()
+{
+    if (!isResumable()) {
+        return false;
+    }
+    // Writes always happen at the end, while reads replay
+    // the data from the beginning.
+    if (!mFile.open(QIODevice::ReadWrite | QIODevice::Append | QIODevice::Unbuffered)
+        || !mFile.seek(0)) {
+        qCWarning(lcWebCal) << "Cannot reopen spool file" << mFile.fileName();
+        remove();
+        return false;
+    }
+    // Spooled data are replayed from a mapping of the file, falling
+    // back to reading it when the file cannot be mapped.
+    mMapSize = mFile.size();
+    mMap = mFile.map(0, mMapSize);
+    mReplayed = 0;
+    return true;
+}
+
+QByteArray DownloadSpool::replay()
+{
+    if (mMap) {
+        const qint64 size = qMin(REPLAY_CHUNK_SIZE, mMapSize - mReplayed);
+        const char *data = reinterpret_cast<const char *>(mMap) + mReplayed;
+        mReplayed += size;
+        return QByteArray::fromRawData(data, int(size));
+    }
+    return mFile.isReadable() ? mFile.read(REPLAY_CHUNK_SIZE) : QByteArray();
+}
+
+bool DownloadSpool::append(const QByteArray &data)
+{
+    if (!mFile.isOpen()) {
+        return false;
+    }
+    if (mFile.write(data) != data.size()) {
+        qCWarning(lcWebCal) << "Cannot write to spool file" << mFile.fileName();
+        remove();
+        return false;
+    }
+    return true;
+}
+
+void DownloadSpool::close()
+{
+    unmap();
+    mFile.close();
+}
+
+void DownloadSpool::remove()
+{
+    unmap();
+    mFile.close();
+    mFile.remove();
+    QFile::remove(mInfoPath);
+    mValidator.clear();
+    mContentEncoding.clear();
+}
+
+void DownloadSpool::unmap()
+{
+    if (mMap) {
+        mFile.unmap(mMap);
+        mMap = nullptr;
+        mMapSize = 0;
+    }
+}
@@ -0,0 +1,95 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef DOWNLOADSPOOL_H
+#define DOWNLOADSPOOL_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+/*! \brief On-disk copy of a partially received feed
+ *
+ * The raw bytes of a response are spooled as they are received,
+ * together with the validator of the response and its content
+ * encoding, so an interrupted download can be resumed later with
+ * a Range request instead of starting again from the beginning.
+ */
+class DownloadSpool
+{
+public:
+    /*! \brief Spool of the feed stored in the given notebook */
+    explicit DownloadSpool(const QString &notebookUid);
+
+    /*! \brief Directory where spool files are stored */
+    static QString directory();
+
+    /*! \brief Checks if a previous download can be resumed */
+    bool isResumable() const;
+
+    /*! \brief Number of bytes already received */
+    qint64 size() const;
+
+    /*! \brief ETag or Last-Modified value of the spooled response */
+    QByteArray validator() const;
+
+    /*! \brief Content-Encoding of the spooled response */
+    QByteArray contentEncoding() const;
+
+    /*! \brief Starts spooling a new response, discarding previous data */
+    bool start(const QByteArray &validator, const QByteArray &contentEncoding);
+
+    /*! \brief Reopens the spool, to replay and append to it */
+    bool resume();
+
+    /*! \brief Next chunk of spooled data after resume(),
+     *  empty when all data have been replayed
+     *
+     * When the spool file can be mapped in memory, chunks refer
+     * to the mapping without copy and are only valid until the
+     * spool is closed or removed.
+     */
+    QByteArray replay();
+
+    /*! \brief Appends newly received data */
+    bool append(const QByteArray &data);
+
+    /*! \brief Closes the spool, keeping its data for a later resume */
+    void close();
+
+    /*! \brief Closes the spool and deletes its data */
+    void remove();
+
+private:
+    Q_DISABLE_COPY(DownloadSpool)
+
+    void unmap();
+
+    QFile mFile;
+    uchar *mMap = nullptr;
+    qint64 mMapSize = 0;
+    qint64 mReplayed = 0;
+    QString mInfoPath;
+    QByteArray mValidator;
+    QByteArray mContentEncoding;
+};
+
+#endif // DOWNLOADSPOOL_H
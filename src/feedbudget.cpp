@@ -0,0 +1,112 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "feedbudget.h"
+
+#include <climits>
+
+// Defaults, large enough for the biggest public feeds.
+static const qint64 DEFAULT_MAX_BYTES = 64 * 1024 * 1024;
+static const int DEFAULT_MAX_INCIDENCES = 100000;
+static const int DEFAULT_MAX_RECURRENCE_DATES = 2000;
+static const int DEFAULT_PARSE_TIMEOUT = 300;
+
+static qint64 limitKey(const Buteo::Profile &profile, const QString &key, qint64 defaultValue)
+{
+    bool ok;
+    const qint64 value = profile.key(key).toLongLong(&ok);
+    if (!ok) {
+        return defaultValue;
+    }
+    return qMax(value, qint64(0));
+}
+
+FeedBudget::FeedBudget()
+    : mMaxBytes(0)
+    , mMaxIncidences(0)
+    , mMaxRecurrenceDates(0)
+    , mParseTimeout(0)
+{
+}
+
+FeedBudget::FeedBudget(const Buteo::Profile &profile)
+    : mMaxBytes(limitKey(profile, QStringLiteral("maxBytes"), DEFAULT_MAX_BYTES))
+    , mMaxIncidences(int(qMin(limitKey(profile, QStringLiteral("maxIncidences"),
+                                       DEFAULT_MAX_INCIDENCES), qint64(INT_MAX))))
+    , mMaxRecurrenceDates(int(qMin(limitKey(profile, QStringLiteral("maxRecurrenceDates"),
+                                            DEFAULT_MAX_RECURRENCE_DATES), qint64(INT_MAX))))
+    , mParseTimeout(limitKey(profile, QStringLiteral("parseTimeout"), DEFAULT_PARSE_TIMEOUT) * 1000)
+{
+}
+
+qint64 FeedBudget::maxBytes() const
+{
+    return mMaxBytes;
+}
+
+int FeedBudget::maxIncidences() const
+{
+    return mMaxIncidences;
+}
+
+int FeedBudget::maxRecurrenceDates() const
+{
+    return mMaxRecurrenceDates;
+}
+
+qint64 FeedBudget::parseTimeout() const
+{
+    return mParseTimeout;
+}
+
+qint64 FeedBudget::value(Limit limit) const
+{
+    switch (limit) {
+    case Bytes:
+        return mMaxBytes;
+    case Incidences:
+        return mMaxIncidences;
+    case RecurrenceDates:
+        return mMaxRecurrenceDates;
+    case ParseTime:
+        return mParseTimeout / 1000;
+    case None:
+        break;
+    }
+    return 0;
+}
+
+QString FeedBudget::name(Limit limit)
+{
+    switch (limit) {
+    case Bytes:
+        return QStringLiteral("maxBytes");
+    case Incidences:
+        return QStringLiteral("maxIncidences");
+    case RecurrenceDates:
+        return QStringLiteral("maxRecurrenceDates");
+    case ParseTime:
+        return QStringLiteral("parseTimeout");
+    case None:
+        break;
+    }
+    return QString();
+}
@@ -0,0 +1,85 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef FEEDBUDGET_H
+#define FEEDBUDGET_H
+
+#include <Profile.h>
+
+#include <QString>
+
+/*! \brief Resources a feed may use during a sync
+ *
+ * Budgets are configured from the keys of the client profile:
+ * - maxBytes: size of the decoded content, in bytes,
+ * - maxIncidences: number of top-level components, parsed or not,
+ * - maxRecurrenceDates: number of EXDATE and RDATE values of
+ *   a single component,
+ * - parseTimeout: seconds spent parsing, not counting the time
+ *   waiting for data.
+ * A missing key uses a default suited to a phone, zero or a
+ * negative value disables the budget.
+ *
+ * A feed exceeding one of them is rejected as soon as it is
+ * detected, while downloading when possible.
+ */
+class FeedBudget
+{
+public:
+    enum Limit {
+        None,
+        Bytes,
+        Incidences,
+        RecurrenceDates,
+        ParseTime
+    };
+
+    /*! \brief Budgets without any limit */
+    FeedBudget();
+    explicit FeedBudget(const Buteo::Profile &profile);
+
+    /*! \brief Maximum content size in bytes, 0 if unlimited */
+    qint64 maxBytes() const;
+
+    /*! \brief Maximum number of components, 0 if unlimited */
+    int maxIncidences() const;
+
+    /*! \brief Maximum number of recurrence dates of a component,
+     *  0 if unlimited */
+    int maxRecurrenceDates() const;
+
+    /*! \brief Parse time in milliseconds, 0 if unlimited */
+    qint64 parseTimeout() const;
+
+    /*! \brief Configured value of a limit, in its profile unit */
+    qint64 value(Limit limit) const;
+
+    /*! \brief Profile key of a limit, like maxBytes */
+    static QString name(Limit limit);
+
+private:
+    qint64 mMaxBytes;
+    int mMaxIncidences;
+    int mMaxRecurrenceDates;
+    qint64 mParseTimeout;
+};
+
+#endif // FEEDBUDGET_H
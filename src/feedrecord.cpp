@@ -0,0 +1,144 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "feedrecord.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QLoggingCategory>
+
+Q_DECLARE_LOGGING_CATEGORY(lcWebCal)
+
+static const quint32 RECORD_MAGIC = 0x57434652; // WCFR
+static const quint32 RECORD_VERSION = 3;
+
+static QDataStream &operator<<(QDataStream &stream, const FeedRecord::Entry &entry)
+{
+    return stream << entry.url << entry.notebookUid << entry.etag
+                  << entry.lastModified << entry.digest << entry.finalUrl
+                  << entry.filterSignature << entry.windowStart << entry.windowEnd
+                  << entry.label << entry.account << entry.name
+                  << entry.history << qint32(entry.unchangedSyncs) << entry.syncDate;
+}
+
+static QDataStream &operator>>(QDataStream &stream, FeedRecord::Entry &entry)
+{
+    qint32 unchangedSyncs;
+    stream >> entry.url >> entry.notebookUid >> entry.etag
+           >> entry.lastModified >> entry.digest >> entry.finalUrl
+           >> entry.filterSignature >> entry.windowStart >> entry.windowEnd
+           >> entry.label >> entry.account >> entry.name
+           >> entry.history >> unchangedSyncs >> entry.syncDate;
+    entry.unchangedSyncs = unchangedSyncs;
+    return stream;
+}
+
+FeedRecord::FeedRecord()
+    : mImporting(false)
+{
+}
+
+QString FeedRecord::path(const QString &profileName)
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+        + QStringLiteral("/webcal/") + profileName + QStringLiteral(".record");
+}
+
+void FeedRecord::remove(const QString &profileName)
+{
+    QFile::remove(path(profileName));
+}
+
+bool FeedRecord::load(const QString &profileName)
+{
+    mImporting = false;
+    mEntries.clear();
+
+    QFile file(path(profileName));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+    quint32 magic, version;
+    stream >> magic >> version;
+    if (magic != RECORD_MAGIC || version != RECORD_VERSION) {
+        return false;
+    }
+    quint32 count;
+    stream >> mImporting >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++) {
+        Entry entry;
+        stream >> entry;
+        mEntries.append(entry);
+    }
+    if (stream.status() != QDataStream::Ok) {
+        qCWarning(lcWebCal) << "Corrupted feed record" << file.fileName();
+        mEntries.clear();
+        return false;
+    }
+    return true;
+}
+
+bool FeedRecord::save(const QString &profileName) const
+{
+    const QString filePath = path(profileName);
+    QDir().mkpath(QFileInfo(filePath).absolutePath());
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(lcWebCal) << "Cannot write feed record" << filePath;
+        return false;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream << RECORD_MAGIC << RECORD_VERSION << mImporting << quint32(mEntries.count());
+    for (const Entry &entry : mEntries) {
+        stream << entry;
+    }
+    return file.commit();
+}
+
+bool FeedRecord::markImporting(const QString &profileName)
+{
+    FeedRecord record;
+    record.load(profileName);
+    record.mImporting = true;
+    return record.save(profileName);
+}
+
+bool FeedRecord::isImporting() const
+{
+    return mImporting;
+}
+
+void FeedRecord::append(const Entry &entry)
+{
+    mEntries.append(entry);
+}
+
+QList<FeedRecord::Entry> FeedRecord::entries() const
+{
+    return mEntries;
+}
@@ -0,0 +1,108 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef FEEDRECORD_H
+#define FEEDRECORD_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QList>
+#include <QString>
+
+/*! \brief Cached state of the feeds of a sync profile
+ *
+ * It mirrors, for each feed, the notebook it is stored in and the
+ * validators, filter and time window recorded in that notebook.
+ * When it still matches the profile, and the windows the notebooks
+ * were imported with still cover the required one, a sync can send
+ * its conditional requests without opening the calendar storage,
+ * which is only needed once the responses are in. Syncs where no
+ * feed changed do not open storage at all: their outcome is kept in
+ * the record, and written to the notebooks with their next change.
+ *
+ * The record is kept in a sidecar file per profile. It is marked as
+ * importing before storage is modified and saved again once the
+ * changes are committed, so a marked or missing record just means
+ * going through storage, where an interrupted import may have left
+ * staging notebooks.
+ */
+class FeedRecord
+{
+public:
+    struct Entry {
+        QString url;
+        QString notebookUid;
+        QByteArray etag;
+        QByteArray lastModified;
+        QByteArray digest;
+        QString finalUrl;
+        // See IncidenceFilter::signature(), the window bounds
+        // being invalid when unbounded.
+        QByteArray filterSignature;
+        QDateTime windowStart;
+        QDateTime windowEnd;
+        // Notebook settings from the profile, and resulting name.
+        QString label;
+        QString account;
+        QString name;
+        // Syncs not written to the notebook yet, when syncDate
+        // is later than the one of the notebook.
+        QString history;
+        int unchangedSyncs;
+        QDateTime syncDate;
+    };
+
+    FeedRecord();
+
+    /*! \brief Path of the record of a profile */
+    static QString path(const QString &profileName);
+
+    /*! \brief Deletes the record of a profile */
+    static void remove(const QString &profileName);
+
+    /*! \brief Loads the record of a profile */
+    bool load(const QString &profileName);
+
+    /*! \brief Saves the record for a profile */
+    bool save(const QString &profileName) const;
+
+    /*! \brief Marks the record of a profile as importing
+     *
+     * Entries are kept, but do not describe the notebooks anymore
+     * until the record is saved again.
+     */
+    static bool markImporting(const QString &profileName);
+
+    /*! \brief Checks if the record was saved while importing */
+    bool isImporting() const;
+
+    /*! \brief Adds a feed, in the order of the profile */
+    void append(const Entry &entry);
+
+    /*! \brief Feeds, in the order of the profile */
+    QList<Entry> entries() const;
+
+private:
+    bool mImporting;
+    QList<Entry> mEntries;
+};
+
+#endif // FEEDRECORD_H
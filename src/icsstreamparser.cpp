@@ -0,0 +1,596 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "icsstreamparser.h"
+
+#include <QLoggingCategory>
+#include <QMutexLocker>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <KCalendarCore/ICalFormat>
+
+Q_DECLARE_LOGGING_CATEGORY(lcWebCal)
+
+static const QByteArray WEBCAL_APP("WEBCAL");
+static const QByteArray HASH_KEY("HASH");
+
+// Number of components parsed together by a thread of the pool.
+static const int BATCH_SIZE = 64;
+
+// Number of batches queued per thread of the pool, at most.
+static const int BATCHES_PER_THREAD = 2;
+
+// Most unfolded lines fit without reallocation.
+static const int LINE_CAPACITY = 256;
+
+Q_GLOBAL_STATIC(QMutex, gFormatLock)
+
+static QByteArray propertyName(const QByteArray &line)
+{
+    int i = 0;
+    while (i < line.size() && line[i] != ':' && line[i] != ';') {
+        i += 1;
+    }
+    return line.left(i).toUpper();
+}
+
+static QByteArray propertyValue(const QByteArray &line)
+{
+    // The value starts at the first colon outside of quoted parameters.
+    bool quoted = false;
+    for (int i = 0; i < line.size(); i++) {
+        if (line[i] == '"') {
+            quoted = !quoted;
+        } else if (line[i] == ':' && !quoted) {
+            return line.mid(i + 1);
+        }
+    }
+    return QByteArray();
+}
+
+static QByteArray parameter(const QByteArray &line, const QByteArray &name)
+{
+    bool quoted = false;
+    int start = -1;
+    for (int i = 0; i < line.size(); i++) {
+        const char c = line[i];
+        if (c == '"') {
+            quoted = !quoted;
+        } else if (!quoted && (c == ';' || c == ':')) {
+            if (start >= 0) {
+                const QByteArray param = line.mid(start, i - start);
+                const int eq = param.indexOf('=');
+                if (eq > 0 && param.left(eq).toUpper() == name) {
+                    QByteArray value = param.mid(eq + 1);
+                    if (value.startsWith('"') && value.endsWith('"') && value.size() > 1) {
+                        value = value.mid(1, value.size() - 2);
+                    }
+                    return value;
+                }
+            }
+            if (c == ':') {
+                break;
+            }
+            start = i + 1;
+        }
+    }
+    return QByteArray();
+}
+
+// Makes the TZID parameters refering to tzid refer to id instead.
+static void replaceTimezone(QByteArray *data, const QByteArray &tzid, const QByteArray &id)
+{
+    const QByteArray value = id.contains(':') ? '"' + id + '"' : id;
+    int from = data->indexOf(tzid);
+    while (from >= 0) {
+        int start = from;
+        int end = from + tzid.size();
+        if (start > 0 && data->at(start - 1) == '"' && end < data->size() && data->at(end) == '"') {
+            start -= 1;
+            end += 1;
+        }
+        if (start >= 5 && end < data->size() && (data->at(end) == ':' || data->at(end) == ';')
+            && data->mid(start - 5, 5).toUpper() == "TZID=") {
+            data->replace(start, end - start, value);
+            end = start + value.size();
+        }
+        from = data->indexOf(tzid, end);
+    }
+}
+
+namespace {
+// Adds the duration of a call to the parse time.
+class ParseClock
+{
+public:
+    ParseClock(QElapsedTimer *timer, QAtomicInteger<qint64> *parseNs)
+        : mTimer(timer)
+        , mParseNs(parseNs)
+    {
+        mTimer->start();
+    }
+    ~ParseClock()
+    {
+        mParseNs->fetchAndAddRelaxed(mTimer->nsecsElapsed());
+        mTimer->invalidate();
+    }
+
+private:
+    QElapsedTimer *mTimer;
+    QAtomicInteger<qint64> *mParseNs;
+};
+}
+
+IcsStreamParser::IcsStreamParser(const IncidenceFilter &filter, TimezoneCache *timezones)
+    : mFilter(filter)
+    , mFiltered(0)
+    , mDigest(QCryptographicHash::Sha256)
+    , mStarted(false)
+    , mDepth(0)
+    , mInterning(qgetenv("WEBCAL_STRING_POOL") != "0")
+    , mComponentHash(QCryptographicHash::Sha1)
+    , mTimezoneCache(timezones)
+    , mMaxBatches(BATCHES_PER_THREAD * qMax(1, QThreadPool::globalInstance()->maxThreadCount()))
+    , mCancellation(nullptr)
+    , mExceeded(FeedBudget::None)
+    , mComponentCount(0)
+    , mRecurrenceDates(0)
+{
+    mLine.reserve(LINE_CAPACITY);
+}
+
+IcsStreamParser::~IcsStreamParser()
+{
+    // Running batches only use copies of the data,
+    // but the plugin may be unloaded after this.
+    for (QFuture<ParsedBatch> &batch : mBatches) {
+        batch.waitForFinished();
+    }
+}
+
+bool IcsStreamParser::append(const QByteArray &data)
+{
+    ParseClock clock(&mCallTimer, &mParseNs);
+    mDigest.addData(data);
+
+    int from = 0;
+    int end;
+    while ((end = data.indexOf('\n', from)) >= 0) {
+        int length = end - from;
+        if (length > 0 && data[end - 1] == '\r') {
+            length -= 1;
+        }
+        // Complete lines are only viewed in place, readLine()
+        // copies what it keeps.
+        QByteArray line;
+        if (!mPending.isEmpty()) {
+            mPending.append(data.constData() + from, length);
+            if (mPending.endsWith('\r')) {
+                mPending.chop(1);
+            }
+            line = mPending;
+            mPending.clear();
+        } else {
+            line = QByteArray::fromRawData(data.constData() + from, length);
+        }
+        from = end + 1;
+        if (!readLine(line)) {
+            return false;
+        }
+    }
+    mPending.append(data.constData() + from, data.size() - from);
+
+    return collectBatches(mMaxBatches);
+}
+
+bool IcsStreamParser::finish()
+{
+    if (isCancelled() || mExceeded != FeedBudget::None) {
+        return false;
+    }
+    ParseClock clock(&mCallTimer, &mParseNs);
+    if (!mPending.isEmpty()) {
+        if (mPending.endsWith('\r')) {
+            mPending.chop(1);
+        }
+        const QByteArray line = mPending;
+        mPending.clear();
+        if (!readLine(line)) {
+            return false;
+        }
+    }
+    if (!mLine.isEmpty() && !processLine(mLine)) {
+        return false;
+    }
+    mLine.clear();
+    mDigestResult = mDigest.result().toHex();
+    if (mDepth > 1) {
+        qCWarning(lcWebCal) << "Truncated ICS data.";
+        return false;
+    }
+
+    // Components refering to time zones that were not defined
+    // before them are parsed once every definitions are known.
+    bool ok = true;
+    for (const Deferred &deferred : mDeferred) {
+        ok = ok && queueComponent(deferred.data, deferred.tzids, deferred.hash);
+    }
+    mDeferred.clear();
+    if (!ok || !startBatch() || !collectBatches(0)) {
+        mIncidences.clear();
+        return false;
+    }
+
+    mCalendar = KCalendarCore::MemoryCalendar::Ptr(new KCalendarCore::MemoryCalendar(QTimeZone::utc()));
+    if (mStarted) {
+        KCalendarCore::ICalFormat iCalFormat;
+        if (!iCalFormat.fromRawString(mCalendar, "BEGIN:VCALENDAR\r\n" + mHeader + "END:VCALENDAR\r\n")) {
+            qCWarning(lcWebCal) << "Cannot parse calendar properties.";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+QByteArray IcsStreamParser::digest() const
+{
+    return mDigestResult;
+}
+
+KCalendarCore::Incidence::List IcsStreamParser::incidences() const
+{
+    return mIncidences;
+}
+
+KCalendarCore::Incidence::List IcsStreamParser::takeIncidences()
+{
+    KCalendarCore::Incidence::List incidences;
+    incidences.swap(mIncidences);
+    return incidences;
+}
+
+void IcsStreamParser::setKnownComponents(const ComponentIndex &known)
+{
+    mKnownComponents = known;
+}
+
+void IcsStreamParser::setCancellation(const QAtomicInt *token)
+{
+    mCancellation = token;
+}
+
+bool IcsStreamParser::isCancelled() const
+{
+    return mCancellation && mCancellation->loadAcquire();
+}
+
+void IcsStreamParser::setBudget(const FeedBudget &budget)
+{
+    mBudget = budget;
+}
+
+FeedBudget::Limit IcsStreamParser::exceededLimit() const
+{
+    return mExceeded;
+}
+
+int IcsStreamParser::componentCount() const
+{
+    return mComponentCount;
+}
+
+qint64 IcsStreamParser::parseTime() const
+{
+    const qint64 running = mCallTimer.isValid() ? mCallTimer.nsecsElapsed() : 0;
+    return (mParseNs.loadAcquire() + running) / 1000000;
+}
+
+bool IcsStreamParser::withinBudget(FeedBudget::Limit limit, qint64 used)
+{
+    const qint64 budget = limit == FeedBudget::ParseTime
+        ? mBudget.parseTimeout() : mBudget.value(limit);
+    if (budget > 0 && used > budget) {
+        qCWarning(lcWebCal) << "Feed exceeds" << FeedBudget::name(limit) << mBudget.value(limit);
+        mExceeded = limit;
+        return false;
+    }
+    return true;
+}
+
+QSet<QString> IcsStreamParser::skippedFingerprints() const
+{
+    return mSkipped;
+}
+
+ComponentIndex IcsStreamParser::components() const
+{
+    return mComponents;
+}
+
+int IcsStreamParser::filteredCount() const
+{
+    return mFiltered;
+}
+
+QString IcsStreamParser::calendarProperty(const QByteArray &name) const
+{
+    return mCalendar ? mCalendar->nonKDECustomProperty(name) : QString();
+}
+
+QString IcsStreamParser::fingerprint(const KCalendarCore::Incidence::Ptr &incidence)
+{
+    return incidence->customProperty(WEBCAL_APP, HASH_KEY);
+}
+
+QMutex *IcsStreamParser::formatLock()
+{
+    return gFormatLock();
+}
+
+bool IcsStreamParser::readLine(const QByteArray &line)
+{
+    // Unfold continuation lines before processing them.
+    if (!line.isEmpty() && (line[0] == ' ' || line[0] == '\t')) {
+        mLine.append(line.constData() + 1, line.size() - 1);
+        return true;
+    }
+    const bool ok = mLine.isEmpty() || processLine(mLine);
+    // Line may only be a view on the received data.
+    mLine.resize(0);
+    mLine.append(line.constData(), line.size());
+    return ok;
+}
+
+bool IcsStreamParser::processLine(const QByteArray &line)
+{
+    if (!mStarted && line.startsWith("\xEF\xBB\xBF")) {
+        return processLine(line.mid(3));
+    }
+
+    const QByteArray name = propertyName(line);
+    if (name == "BEGIN") {
+        const QByteArray type = propertyValue(line).trimmed().toUpper();
+        if (mDepth == 0) {
+            if (type != "VCALENDAR") {
+                qCWarning(lcWebCal) << "Unexpected component" << type;
+                return false;
+            }
+            mStarted = true;
+            mDepth = 1;
+            return true;
+        } else if (mDepth == 1) {
+            mComponentType = type;
+            mComponent.clear();
+            mComponentTzids.clear();
+            mComponentUid.clear();
+            mComponentRecurrenceId.clear();
+            mRecurrenceDates = 0;
+            mTimezoneId.clear();
+            mComponentHash.reset();
+        }
+        mDepth += 1;
+    } else if (name == "END") {
+        if (mDepth <= 1) {
+            mDepth = 0;
+            return true;
+        }
+        mDepth -= 1;
+    } else if (mDepth == 0) {
+        // Ignore trailing data, but not a document that is not ICS.
+        return mStarted;
+    } else if (mDepth == 1) {
+        mHeader.append(line).append("\r\n");
+        return true;
+    } else if (mComponentType == "VTIMEZONE" && mDepth == 2 && name == "TZID") {
+        mTimezoneId = propertyValue(line);
+    } else {
+        const QByteArray tzid = parameter(line, "TZID");
+        if (!tzid.isEmpty()) {
+            mComponentTzids.insert(tzid);
+        }
+        if (mDepth == 2 && name == "UID") {
+            mComponentUid = propertyValue(line);
+        } else if (mDepth == 2 && name == "RECURRENCE-ID") {
+            mComponentRecurrenceId = line;
+        } else if (mDepth == 2 && (name == "EXDATE" || name == "RDATE")) {
+            // Each date is expanded and compared on every recurrence.
+            mRecurrenceDates += propertyValue(line).count(',') + 1;
+            if (!withinBudget(FeedBudget::RecurrenceDates, mRecurrenceDates)) {
+                return false;
+            }
+        }
+    }
+
+    // Properties are projected before parsing, the fingerprint
+    // then ignores changes in properties that are not stored.
+    QByteArray content = line;
+    if (mDepth == 2 && name != "BEGIN" && name != "END"
+        && mComponentType != "VTIMEZONE" && mFilter.projects()) {
+        if (!mFilter.keepsProperty(name)) {
+            return true;
+        }
+        content = mFilter.project(name, line);
+    }
+
+    // DTSTAMP and LAST-MODIFIED are regenerated by many servers on
+    // every request, they are not part of the content fingerprint.
+    if (name != "DTSTAMP" && name != "LAST-MODIFIED") {
+        mComponentHash.addData(content);
+        mComponentHash.addData("\n", 1);
+    }
+    mComponent.append(content).append("\r\n");
+
+    return mDepth > 1 || processComponent();
+}
+
+bool IcsStreamParser::processComponent()
+{
+    if (isCancelled() || !withinBudget(FeedBudget::ParseTime, parseTime())) {
+        return false;
+    }
+    if (mComponentType == "VTIMEZONE") {
+        mTimezones.insert(mTimezoneId, mComponent);
+        if (mTimezoneCache) {
+            const QByteArray id = mTimezoneCache->resolve(mTimezoneId, mComponent,
+                                                          mComponentHash.result().toHex());
+            if (!id.isEmpty()) {
+                mTimezoneIds.insert(mTimezoneId, id);
+            }
+        }
+        return true;
+    }
+    mComponentCount += 1;
+    if (!withinBudget(FeedBudget::Incidences, mComponentCount)) {
+        return false;
+    }
+    if (!mFilter.acceptsType(mComponentType)) {
+        mFiltered += 1;
+        return true;
+    }
+
+    const QByteArray hash = mComponentHash.result().toHex();
+    const QByteArray key = ComponentIndex::key(mComponentUid, mComponentRecurrenceId);
+    mComponents.insert(key, hash);
+    if (mKnownComponents.contains(key, hash)) {
+        // Already stored as it is, no need to parse it again.
+        mSkipped.insert(QString::fromLatin1(hash));
+        return true;
+    }
+    for (const QByteArray &tzid : mComponentTzids) {
+        if (!mTimezones.contains(tzid)) {
+            mDeferred.append(Deferred{mComponent, mComponentTzids, hash});
+            return true;
+        }
+    }
+    return queueComponent(mComponent, mComponentTzids, hash);
+}
+
+bool IcsStreamParser::queueComponent(const QByteArray &component,
+                                     const QSet<QByteArray> &tzids,
+                                     const QByteArray &hash)
+{
+    // Time zone definitions are resolved here, so batches
+    // do not depend on the state of the parser.
+    QByteArray data;
+    QByteArray body = component;
+    for (const QByteArray &tzid : tzids) {
+        const QByteArray id = mTimezoneIds.value(tzid);
+        if (id.isEmpty()) {
+            data.append(mTimezones.value(tzid));
+        } else if (id != tzid) {
+            replaceTimezone(&body, tzid, id);
+        }
+    }
+    const bool timezones = !data.isEmpty();
+    data.append(body);
+    mBatch.append(Component{data, hash, timezones});
+    return mBatch.size() < BATCH_SIZE || startBatch();
+}
+
+bool IcsStreamParser::startBatch()
+{
+    if (mBatch.isEmpty()) {
+        return true;
+    }
+    // Wait for the oldest batches when the pool is behind.
+    if (!collectBatches(mMaxBatches - 1)) {
+        return false;
+    }
+    mBatches.append(QtConcurrent::run(this, &IcsStreamParser::parseBatch, mHeader, mBatch));
+    mBatch.clear();
+    return true;
+}
+
+bool IcsStreamParser::collectBatches(int running)
+{
+    // Results are collected in order, a failure is noticed once
+    // the batches queued before are finished. Batches left
+    // running are waited for by the destructor.
+    while (!mBatches.isEmpty()
+           && (mBatches.count() > running || mBatches.first().isFinished())) {
+        // Waiting is not parsing, the batch counts its own time.
+        mParseNs.fetchAndAddRelaxed(mCallTimer.nsecsElapsed());
+        const ParsedBatch result = mBatches.takeFirst().result();
+        mCallTimer.start();
+        if (!result.ok) {
+            if (result.expired) {
+                mExceeded = FeedBudget::ParseTime;
+            }
+            return false;
+        }
+        if (mInterning) {
+            for (const KCalendarCore::Incidence::Ptr &incidence : result.incidences) {
+                mStrings.intern(incidence);
+            }
+        }
+        mIncidences += result.incidences;
+        mFiltered += result.filtered;
+    }
+    return true;
+}
+
+IcsStreamParser::ParsedBatch IcsStreamParser::parseBatch(const QByteArray &header,
+                                                         const QList<Component> &components) const
+{
+    ParsedBatch batch;
+    KCalendarCore::ICalFormat iCalFormat;
+    const qint64 timeout = mBudget.parseTimeout();
+    for (const Component &component : components) {
+        if (isCancelled()) {
+            batch.ok = false;
+            return batch;
+        }
+        if (timeout > 0 && mParseNs.loadAcquire() / 1000000 > timeout) {
+            batch.ok = false;
+            batch.expired = true;
+            return batch;
+        }
+        QByteArray data("BEGIN:VCALENDAR\r\n");
+        data.append(header);
+        data.append(component.data);
+        data.append("END:VCALENDAR\r\n");
+
+        KCalendarCore::MemoryCalendar::Ptr calendar(new KCalendarCore::MemoryCalendar(QTimeZone::utc()));
+        QMutexLocker lock(component.timezones ? formatLock() : nullptr);
+        QElapsedTimer clock;
+        clock.start();
+        const bool parsed = iCalFormat.fromRawString(calendar, data);
+        lock.unlock();
+        if (!parsed) {
+            qCWarning(lcWebCal) << "Cannot parse component.";
+            batch.ok = false;
+            return batch;
+        }
+        for (const KCalendarCore::Incidence::Ptr &incidence : calendar->incidences()) {
+            if (!mFilter.accepts(incidence)) {
+                batch.filtered += 1;
+                continue;
+            }
+            incidence->setCustomProperty(WEBCAL_APP, HASH_KEY, QString::fromLatin1(component.hash));
+            batch.incidences.append(incidence);
+        }
+        mParseNs.fetchAndAddRelaxed(clock.nsecsElapsed());
+    }
+
+    return batch;
+}
@@ -0,0 +1,242 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef ICSSTREAMPARSER_H
+#define ICSSTREAMPARSER_H
+
+#include "incidencefilter.h"
+#include "timezonecache.h"
+#include "componentindex.h"
+#include "stringpool.h"
+#include "feedbudget.h"
+
+#include <KCalendarCore/Incidence>
+#include <KCalendarCore/MemoryCalendar>
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QFuture>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSet>
+
+/*! \brief Incremental parser for ICS data
+ *
+ * Data can be appended as they are received. The stream is split on
+ * the boundaries of the top-level components of the VCALENDAR, and
+ * each component is parsed as soon as it is complete, together with
+ * the VTIMEZONE definitions it refers to. Only the incomplete
+ * component is kept in memory, not the whole payload.
+ *
+ * Every parsed incidence is given a fingerprint of its raw data, see
+ * fingerprint(). Incidences rejected by the filter are dropped as soon
+ * as they are parsed, or even before when their type is rejected.
+ *
+ * When given a TimezoneCache, VTIMEZONE definitions are resolved to
+ * system time zones once, and components refer to them directly,
+ * instead of being parsed together with the definitions.
+ *
+ * Components known from a previous sync with the same fingerprint,
+ * see setKnownComponents(), are not parsed at all. They are only
+ * reported by skippedFingerprints().
+ *
+ * Complete components are parsed by batches on the global thread pool,
+ * each with its own ICalFormat, while the stream is still being split.
+ * Results are collected in the order of the batches, so incidences()
+ * keeps the order of the stream, except for components whose time
+ * zones were defined after them, which come last. Only a few batches
+ * per thread are queued at a time, the splitting waits for the oldest
+ * one otherwise. Repeated values of collected incidences are shared
+ * through a StringPool, unless WEBCAL_STRING_POOL is set to 0 in the
+ * environment, to measure what it saves. Only components carrying time zone
+ * definitions are parsed one at a time, see formatLock().
+ *
+ * Parsing can be cancelled from another thread, see setCancellation(),
+ * and stops when the feed exceeds its budget, see setBudget().
+ */
+class IcsStreamParser
+{
+public:
+    explicit IcsStreamParser(const IncidenceFilter &filter = IncidenceFilter(),
+                             TimezoneCache *timezones = nullptr);
+    ~IcsStreamParser();
+
+    /*! \brief Parses a new chunk of raw ICS data
+     *
+     * @param data the next bytes of the stream
+     * @return false if the data cannot be parsed
+     */
+    bool append(const QByteArray &data);
+
+    /*! \brief Parses remaining data at the end of the stream
+     *
+     * @return false if the data cannot be parsed
+     */
+    bool finish();
+
+    /*! \brief SHA-256 digest of all the appended data, in hexadecimal,
+     *  available after finish() */
+    QByteArray digest() const;
+
+    /*! \brief Incidences parsed so far */
+    KCalendarCore::Incidence::List incidences() const;
+
+    /*! \brief Incidences parsed so far, the parser does not
+     *  keep them anymore */
+    KCalendarCore::Incidence::List takeIncidences();
+
+    /*! \brief Index of the components already stored
+     *
+     * Must be given before appending data.
+     */
+    void setKnownComponents(const ComponentIndex &known);
+
+    /*! \brief Token cancelling the parsing once set
+     *
+     * It is checked between components, by the running batches too,
+     * append() and finish() then fail. It must outlive the parser.
+     */
+    void setCancellation(const QAtomicInt *token);
+
+    /*! \brief Limits on the number of components, their recurrence
+     *  dates and the parse time
+     *
+     * Parse time is the time spent in append() and finish(), and by
+     * the batches, not the time waiting for data. When a limit is
+     * exceeded, append() and finish() fail, and exceededLimit()
+     * tells which one.
+     */
+    void setBudget(const FeedBudget &budget);
+
+    /*! \brief Limit of the budget that was exceeded, if any */
+    FeedBudget::Limit exceededLimit() const;
+
+    /*! \brief Number of top-level components read so far,
+     *  except time zones */
+    int componentCount() const;
+
+    /*! \brief Fingerprints of the known components that were
+     *  skipped because they did not change */
+    QSet<QString> skippedFingerprints() const;
+
+    /*! \brief Index of all the top-level components read so far,
+     *  parsed or skipped */
+    ComponentIndex components() const;
+
+    /*! \brief Number of components rejected by the filter */
+    int filteredCount() const;
+
+    /*! \brief Value of a non-KDE property of the VCALENDAR,
+     *  like X-WR-CALNAME, available after finish() */
+    QString calendarProperty(const QByteArray &name) const;
+
+    /*! \brief Fingerprint of the raw data an incidence was parsed from */
+    static QString fingerprint(const KCalendarCore::Incidence::Ptr &incidence);
+
+    /*! \brief Lock to hold while parsing VTIMEZONE definitions
+     *
+     * libical registers the time zones it builds from definitions
+     * in globals, which are not safe to use from several threads.
+     * The rest of the parsing only uses the state of its ICalFormat.
+     */
+    static QMutex *formatLock();
+
+private:
+    Q_DISABLE_COPY(IcsStreamParser)
+
+    struct Component {
+        QByteArray data;
+        QByteArray hash;
+        // Carries VTIMEZONE definitions, see formatLock().
+        bool timezones;
+    };
+    struct ParsedBatch {
+        KCalendarCore::Incidence::List incidences;
+        int filtered = 0;
+        bool ok = true;
+        bool expired = false;
+    };
+    // Runs on the pool, only using the filter, the budget and the
+    // cancellation token, which do not change once parsing started.
+    ParsedBatch parseBatch(const QByteArray &header, const QList<Component> &components) const;
+
+    bool readLine(const QByteArray &line);
+    bool processLine(const QByteArray &line);
+    bool processComponent();
+    bool queueComponent(const QByteArray &component, const QSet<QByteArray> &tzids,
+                        const QByteArray &hash);
+    bool startBatch();
+    bool collectBatches(int running);
+    bool isCancelled() const;
+    qint64 parseTime() const;
+    bool withinBudget(FeedBudget::Limit limit, qint64 used);
+
+    IncidenceFilter mFilter;
+    int mFiltered;
+    QCryptographicHash mDigest;
+    QByteArray mDigestResult;
+    QByteArray mPending;
+    QByteArray mLine;
+    bool mStarted;
+    int mDepth;
+    QByteArray mHeader;
+    QByteArray mComponent;
+    QByteArray mComponentType;
+    QSet<QByteArray> mComponentTzids;
+    QByteArray mComponentUid;
+    QByteArray mComponentRecurrenceId;
+    ComponentIndex mKnownComponents;
+    ComponentIndex mComponents;
+    QSet<QString> mSkipped;
+    StringPool mStrings;
+    bool mInterning;
+    QByteArray mTimezoneId;
+    QCryptographicHash mComponentHash;
+    QHash<QByteArray, QByteArray> mTimezones;
+    TimezoneCache *mTimezoneCache;
+    QHash<QByteArray, QByteArray> mTimezoneIds;
+    struct Deferred {
+        QByteArray data;
+        QSet<QByteArray> tzids;
+        QByteArray hash;
+    };
+    QList<Deferred> mDeferred;
+    QList<Component> mBatch;
+    // Batches not collected yet, in the order of the stream.
+    QList<QFuture<ParsedBatch>> mBatches;
+    int mMaxBatches;
+    const QAtomicInt *mCancellation;
+    FeedBudget mBudget;
+    FeedBudget::Limit mExceeded;
+    // Time spent parsing, by the calls and the batches.
+    mutable QAtomicInteger<qint64> mParseNs;
+    // Running while in append() or finish().
+    QElapsedTimer mCallTimer;
+    int mComponentCount;
+    int mRecurrenceDates;
+    KCalendarCore::Incidence::List mIncidences;
+    KCalendarCore::MemoryCalendar::Ptr mCalendar;
+};
+
+#endif // ICSSTREAMPARSER_H
@@ -0,0 +1,324 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "incidencefilter.h"
+
+#include <QLoggingCategory>
+#include <QCryptographicHash>
+
+Q_DECLARE_LOGGING_CATEGORY(lcWebCal)
+
+static QSet<QString> listKey(const Buteo::Profile &profile, const QString &key)
+{
+    QSet<QString> values;
+    for (const QString &value : profile.key(key).split(QLatin1Char(','), QString::SkipEmptyParts)) {
+        values.insert(value.trimmed().toLower());
+    }
+    return values;
+}
+
+static QSet<QByteArray> nameListKey(const Buteo::Profile &profile, const QString &key)
+{
+    QSet<QByteArray> names;
+    for (const QString &value : profile.key(key).split(QLatin1Char(','), QString::SkipEmptyParts)) {
+        names.insert(value.trimmed().toUpper().toLatin1());
+    }
+    return names;
+}
+
+// Properties needed to identify and schedule an incidence.
+static const QSet<QByteArray> REQUIRED_PROPERTIES {
+    "UID", "DTSTAMP", "SEQUENCE", "RECURRENCE-ID",
+    "DTSTART", "DTEND", "DUE", "DURATION",
+    "RRULE", "RDATE", "EXRULE", "EXDATE"
+};
+
+static QDateTime dateTimeKey(const Buteo::Profile &profile, const QString &key)
+{
+    const QString value = profile.key(key);
+    QDateTime dt = QDateTime::fromString(value, Qt::ISODate);
+    if (!dt.isValid()) {
+        const QDate date = QDate::fromString(value, Qt::ISODate);
+        if (date.isValid()) {
+            dt = QDateTime(date, QTime(0, 0));
+        }
+    }
+    if (!value.isEmpty() && !dt.isValid()) {
+        qCWarning(lcWebCal) << "Ignoring invalid date" << key << value;
+    }
+    return dt;
+}
+
+static QRegularExpression regExpKey(const Buteo::Profile &profile, const QString &key)
+{
+    const QString pattern = profile.key(key);
+    if (pattern.isEmpty()) {
+        return QRegularExpression();
+    }
+    QRegularExpression regExp(pattern, QRegularExpression::CaseInsensitiveOption
+                              | QRegularExpression::UseUnicodePropertiesOption);
+    if (!regExp.isValid()) {
+        qCWarning(lcWebCal) << "Ignoring invalid expression" << key << regExp.errorString();
+        return QRegularExpression();
+    }
+    // Compile it once, instead of at first match.
+    regExp.optimize();
+    return regExp;
+}
+
+static int statusFromName(const QString &name)
+{
+    if (name == QStringLiteral("tentative")) {
+        return KCalendarCore::Incidence::StatusTentative;
+    } else if (name == QStringLiteral("confirmed")) {
+        return KCalendarCore::Incidence::StatusConfirmed;
+    } else if (name == QStringLiteral("completed")) {
+        return KCalendarCore::Incidence::StatusCompleted;
+    } else if (name == QStringLiteral("needs-action")) {
+        return KCalendarCore::Incidence::StatusNeedsAction;
+    } else if (name == QStringLiteral("cancelled") || name == QStringLiteral("canceled")) {
+        return KCalendarCore::Incidence::StatusCanceled;
+    } else if (name == QStringLiteral("in-process")) {
+        return KCalendarCore::Incidence::StatusInProcess;
+    } else if (name == QStringLiteral("draft")) {
+        return KCalendarCore::Incidence::StatusDraft;
+    } else if (name == QStringLiteral("final")) {
+        return KCalendarCore::Incidence::StatusFinal;
+    }
+    qCWarning(lcWebCal) << "Ignoring unknown status" << name;
+    return -1;
+}
+
+IncidenceFilter::IncidenceFilter()
+{
+}
+
+IncidenceFilter::IncidenceFilter(const Buteo::Profile &profile, const QDateTime &now)
+    : mStart(dateTimeKey(profile, QStringLiteral("filterStart")))
+    , mEnd(dateTimeKey(profile, QStringLiteral("filterEnd")))
+    , mIncludeCategories(listKey(profile, QStringLiteral("includeCategories")))
+    , mExcludeCategories(listKey(profile, QStringLiteral("excludeCategories")))
+    , mSummary(regExpKey(profile, QStringLiteral("summaryFilter")))
+    , mLocation(regExpKey(profile, QStringLiteral("locationFilter")))
+{
+    // Keep the rolling window stable during a day.
+    const QDateTime today(now.toUTC().date(), QTime(0, 0), Qt::UTC);
+    bool ok;
+    const int pastDays = profile.key(QStringLiteral("pastDays")).toInt(&ok);
+    if (ok && pastDays >= 0) {
+        const QDateTime start = today.addDays(-pastDays);
+        if (!mStart.isValid() || start > mStart) {
+            mStart = start;
+        }
+    }
+    mRequiredEnd = mEnd;
+    const int futureDays = profile.key(QStringLiteral("futureDays")).toInt(&ok);
+    if (ok && futureDays >= 0) {
+        const QDateTime end = today.addDays(futureDays + 1);
+        if (!mRequiredEnd.isValid() || end < mRequiredEnd) {
+            mRequiredEnd = end;
+        }
+        // Import some more days, so the next syncs do not have to
+        // import everything again only because the window moved.
+        const QDateTime margin = end.addDays(futureDays / 4 + 1);
+        if (!mEnd.isValid() || margin < mEnd) {
+            mEnd = margin;
+        }
+    }
+    QCryptographicHash signature(QCryptographicHash::Sha1);
+    for (const char *key : {"filterStart", "filterEnd", "includeCategories", "excludeCategories",
+                            "summaryFilter", "locationFilter", "incidenceTypes", "excludeStatus",
+                            "keepProperties", "dropProperties", "maxDescriptionLength"}) {
+        signature.addData(profile.key(QString::fromLatin1(key)).toUtf8());
+        signature.addData("\n", 1);
+    }
+    mSignature = signature.result().toHex();
+
+    for (const QString &type : listKey(profile, QStringLiteral("incidenceTypes"))) {
+        mTypes.insert("V" + type.toUpper().toLatin1());
+    }
+    for (const QString &status : listKey(profile, QStringLiteral("excludeStatus"))) {
+        const int value = statusFromName(status);
+        if (value >= 0) {
+            mExcludeStatus.insert(value);
+        }
+    }
+
+    mKeepProperties = nameListKey(profile, QStringLiteral("keepProperties"));
+    for (const QByteArray &name : nameListKey(profile, QStringLiteral("dropProperties"))) {
+        if (name.endsWith('*')) {
+            mDropPrefixes.append(name.left(name.size() - 1));
+        } else {
+            mDropProperties.insert(name);
+        }
+    }
+    const int maxDescriptionLength = profile.key(QStringLiteral("maxDescriptionLength")).toInt(&ok);
+    if (ok && maxDescriptionLength >= 0) {
+        mMaxDescriptionLength = maxDescriptionLength;
+    }
+}
+
+QByteArray IncidenceFilter::signature() const
+{
+    return mSignature;
+}
+
+QDateTime IncidenceFilter::windowStart() const
+{
+    return mStart;
+}
+
+QDateTime IncidenceFilter::windowEnd() const
+{
+    return mEnd;
+}
+
+bool IncidenceFilter::covers(const QDateTime &start, const QDateTime &end) const
+{
+    return (!start.isValid() || (mStart.isValid() && start <= mStart))
+        && (!end.isValid() || (mRequiredEnd.isValid() && end >= mRequiredEnd));
+}
+
+bool IncidenceFilter::acceptsType(const QByteArray &componentType) const
+{
+    return mTypes.isEmpty() || mTypes.contains(componentType);
+}
+
+bool IncidenceFilter::projects() const
+{
+    return !mKeepProperties.isEmpty() || !mDropProperties.isEmpty()
+        || !mDropPrefixes.isEmpty() || mMaxDescriptionLength >= 0;
+}
+
+bool IncidenceFilter::keepsProperty(const QByteArray &name) const
+{
+    if (REQUIRED_PROPERTIES.contains(name)) {
+        return true;
+    }
+    if (!mKeepProperties.isEmpty() && !mKeepProperties.contains(name)) {
+        return false;
+    }
+    if (mDropProperties.contains(name)) {
+        return false;
+    }
+    for (const QByteArray &prefix : mDropPrefixes) {
+        if (name.startsWith(prefix)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+QByteArray IncidenceFilter::project(const QByteArray &name, const QByteArray &line) const
+{
+    if (mMaxDescriptionLength < 0 || name != "DESCRIPTION") {
+        return line;
+    }
+    // The value starts at the first colon outside of quoted parameters.
+    int start = -1;
+    bool quoted = false;
+    for (int i = 0; i < line.size() && start < 0; i++) {
+        if (line[i] == '"') {
+            quoted = !quoted;
+        } else if (line[i] == ':' && !quoted) {
+            start = i + 1;
+        }
+    }
+    if (start < 0 || line.size() - start <= mMaxDescriptionLength) {
+        return line;
+    }
+    // Do not cut an UTF-8 sequence, nor an escaped character.
+    int end = start + mMaxDescriptionLength;
+    while (end > start && (uchar(line[end]) & 0xC0) == 0x80) {
+        end -= 1;
+    }
+    int escapes = 0;
+    for (int i = end - 1; i >= start && line[i] == '\\'; i--) {
+        escapes += 1;
+    }
+    if (escapes % 2) {
+        end -= 1;
+    }
+    return line.left(end) + "\xE2\x80\xA6";
+}
+
+bool IncidenceFilter::accepts(const KCalendarCore::Incidence::Ptr &incidence) const
+{
+    if (!mExcludeStatus.isEmpty() && mExcludeStatus.contains(incidence->status())) {
+        return false;
+    }
+    if (!mIncludeCategories.isEmpty() || !mExcludeCategories.isEmpty()) {
+        bool included = mIncludeCategories.isEmpty();
+        for (const QString &category : incidence->categories()) {
+            const QString name = category.trimmed().toLower();
+            if (mExcludeCategories.contains(name)) {
+                return false;
+            }
+            included = included || mIncludeCategories.contains(name);
+        }
+        if (!included) {
+            return false;
+        }
+    }
+    if (mSummary.isValid() && !mSummary.pattern().isEmpty()
+        && !mSummary.match(incidence->summary()).hasMatch()) {
+        return false;
+    }
+    if (mLocation.isValid() && !mLocation.pattern().isEmpty()
+        && !mLocation.match(incidence->location()).hasMatch()) {
+        return false;
+    }
+    return (!mStart.isValid() && !mEnd.isValid()) || overlaps(incidence, mStart, mEnd);
+}
+
+bool IncidenceFilter::overlaps(const KCalendarCore::Incidence::Ptr &incidence,
+                               const QDateTime &start, const QDateTime &end)
+{
+    QDateTime first = incidence->dtStart();
+    QDateTime last = incidence->dateTime(KCalendarCore::IncidenceBase::RoleEnd);
+    if (!first.isValid()) {
+        first = last;
+    }
+    if (!first.isValid()) {
+        // Nothing to compare with.
+        return true;
+    }
+    if (!last.isValid() || last < first) {
+        last = first;
+    }
+    if (incidence->allDay()) {
+        // End date of all day incidences is inclusive.
+        last = last.addDays(1);
+    }
+
+    if (end.isValid() && first > end) {
+        return false;
+    }
+    if (!start.isValid()) {
+        return true;
+    }
+    if (incidence->recurs()) {
+        // Look for the first occurrence still running at start.
+        const QDateTime next = incidence->recurrence()->getNextDateTime(start.addSecs(-first.secsTo(last) - 1));
+        return next.isValid() && (!end.isValid() || next <= end);
+    }
+    return last >= start;
+}
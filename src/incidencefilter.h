@@ -0,0 +1,151 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef INCIDENCEFILTER_H
+#define INCIDENCEFILTER_H
+
+#include <Profile.h>
+
+#include <KCalendarCore/Incidence>
+
+#include <QDateTime>
+#include <QRegularExpression>
+#include <QList>
+#include <QSet>
+
+/*! \brief Selects which incidences of a feed are stored
+ *
+ * The filter is configured from the keys of the client profile:
+ * - filterStart, filterEnd: ISO 8601 bounds of a time window,
+ *   incidences, or one of their recurrences, must overlap it,
+ * - includeCategories, excludeCategories: comma separated lists
+ *   of categories, compared case insensitively,
+ * - summaryFilter, locationFilter: regular expressions that the
+ *   summary or the location must match,
+ * - incidenceTypes: comma separated list of event, todo, journal,
+ * - excludeStatus: comma separated list of statuses, like
+ *   tentative or cancelled,
+ * - pastDays, futureDays: bounds of a rolling time window around
+ *   the current day. Incidences are imported a bit further in the
+ *   future than required, so the window is still covered by the
+ *   imported data for some days, see covers().
+ *
+ * It also projects the properties of stored incidences, to keep
+ * only what is used from large feeds:
+ * - keepProperties: comma separated list of the only properties
+ *   to store, like SUMMARY,LOCATION,
+ * - dropProperties: comma separated list of properties not to
+ *   store, like ATTACH,X-ALT-DESC. A trailing * matches any
+ *   property starting with the rest of the name, like X-*,
+ * - maxDescriptionLength: number of bytes the description is
+ *   truncated to.
+ * Properties identifying and scheduling an incidence are always
+ * kept, as well as the properties of nested components, like
+ * alarms. The projection is applied on the content lines before
+ * parsing, so the other filters see projected incidences.
+ *
+ * Regular expressions are compiled once when the filter is created.
+ */
+class IncidenceFilter
+{
+public:
+    IncidenceFilter();
+    explicit IncidenceFilter(const Buteo::Profile &profile,
+                             const QDateTime &now = QDateTime::currentDateTimeUtc());
+
+    /*! \brief Checks if components of the given type are stored
+     *
+     * This allows to reject components before parsing them.
+     *
+     * @param componentType an iCalendar component name, like VEVENT
+     */
+    bool acceptsType(const QByteArray &componentType) const;
+
+    /*! \brief Checks if a projection of properties is configured */
+    bool projects() const;
+
+    /*! \brief Checks if a property of an incidence is stored
+     *
+     * @param name an upper case iCalendar property name, like ATTACH
+     */
+    bool keepsProperty(const QByteArray &name) const;
+
+    /*! \brief Content line of a kept property, as it is stored
+     *
+     * @param name upper case name of the property
+     * @param line unfolded content line
+     * @return the line, with its value truncated when too long
+     */
+    QByteArray project(const QByteArray &name, const QByteArray &line) const;
+
+    /*! \brief Checks if a parsed incidence should be stored */
+    bool accepts(const KCalendarCore::Incidence::Ptr &incidence) const;
+
+    /*! \brief Fingerprint of the filter settings, except the rolling
+     *  window bounds, to detect configuration changes */
+    QByteArray signature() const;
+
+    /*! \brief Beginning of the time window of imported incidences,
+     *  invalid if unbounded */
+    QDateTime windowStart() const;
+
+    /*! \brief End of the time window of imported incidences,
+     *  invalid if unbounded */
+    QDateTime windowEnd() const;
+
+    /*! \brief Checks if a previously imported window still covers
+     *  the currently required one
+     *
+     * When it does not, incidences of the feed must be imported again,
+     * even if the feed did not change.
+     *
+     * @param start beginning of the imported window, invalid if unbounded
+     * @param end end of the imported window, invalid if unbounded
+     */
+    bool covers(const QDateTime &start, const QDateTime &end) const;
+
+    /*! \brief Checks if an incidence, or one of its recurrences,
+     *  overlaps a time window
+     *
+     * @param start beginning of the window, open if invalid
+     * @param end end of the window, open if invalid
+     */
+    static bool overlaps(const KCalendarCore::Incidence::Ptr &incidence,
+                         const QDateTime &start, const QDateTime &end);
+
+private:
+    QDateTime mStart;
+    QDateTime mEnd;
+    QDateTime mRequiredEnd;
+    QSet<QString> mIncludeCategories;
+    QSet<QString> mExcludeCategories;
+    QRegularExpression mSummary;
+    QRegularExpression mLocation;
+    QSet<QByteArray> mTypes;
+    QSet<int> mExcludeStatus;
+    QSet<QByteArray> mKeepProperties;
+    QSet<QByteArray> mDropProperties;
+    QList<QByteArray> mDropPrefixes;
+    int mMaxDescriptionLength = -1;
+    QByteArray mSignature;
+};
+
+#endif // INCIDENCEFILTER_H
@@ -0,0 +1,222 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "occurrenceindex.h"
+#include "icsstreamparser.h"
+
+#include <KCalendarCore/Recurrence>
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSet>
+#include <QStandardPaths>
+#include <QLoggingCategory>
+
+#include <algorithm>
+
+Q_DECLARE_LOGGING_CATEGORY(lcWebCal)
+
+static const quint32 INDEX_MAGIC = 0x57434f49; // WCOI
+static const quint32 INDEX_VERSION = 1;
+
+OccurrenceIndex::OccurrenceIndex()
+{
+}
+
+QString OccurrenceIndex::path(const QString &notebookUid)
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+        + QStringLiteral("/webcal/") + notebookUid + QStringLiteral(".occurrences");
+}
+
+void OccurrenceIndex::remove(const QString &notebookUid)
+{
+    QFile::remove(path(notebookUid));
+}
+
+bool OccurrenceIndex::load(const QString &notebookUid)
+{
+    mEntries.clear();
+    mStart = mEnd = QDateTime();
+
+    QFile file(path(notebookUid));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+    quint32 magic, version;
+    stream >> magic >> version;
+    if (magic != INDEX_MAGIC || version != INDEX_VERSION) {
+        return false;
+    }
+    qint64 start, end;
+    quint32 count;
+    stream >> start >> end >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++) {
+        Entry entry;
+        stream >> entry.uid >> entry.recurrenceId >> entry.fingerprint
+               >> entry.duration >> entry.starts;
+        mEntries.insert(entry.recurrenceId
+                        ? entry.uid + QLatin1Char('\n') + QString::number(entry.recurrenceId)
+                        : entry.uid, entry);
+    }
+    if (stream.status() != QDataStream::Ok) {
+        qCWarning(lcWebCal) << "Corrupted occurrence index" << file.fileName();
+        mEntries.clear();
+        return false;
+    }
+    mStart = QDateTime::fromMSecsSinceEpoch(start, Qt::UTC);
+    mEnd = QDateTime::fromMSecsSinceEpoch(end, Qt::UTC);
+    return true;
+}
+
+bool OccurrenceIndex::save(const QString &notebookUid) const
+{
+    const QString filePath = path(notebookUid);
+    QDir().mkpath(QFileInfo(filePath).absolutePath());
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(lcWebCal) << "Cannot write occurrence index" << filePath;
+        return false;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream << INDEX_MAGIC << INDEX_VERSION
+           << mStart.toMSecsSinceEpoch() << mEnd.toMSecsSinceEpoch()
+           << quint32(mEntries.count());
+    for (const Entry &entry : mEntries) {
+        stream << entry.uid << entry.recurrenceId << entry.fingerprint
+               << entry.duration << entry.starts;
+    }
+    return file.commit();
+}
+
+void OccurrenceIndex::setWindow(const QDateTime &start, const QDateTime &end)
+{
+    if (start != mStart || end != mEnd) {
+        mEntries.clear();
+        mStart = start;
+        mEnd = end;
+    }
+}
+
+QDateTime OccurrenceIndex::windowStart() const
+{
+    return mStart;
+}
+
+QDateTime OccurrenceIndex::windowEnd() const
+{
+    return mEnd;
+}
+
+QString OccurrenceIndex::key(const KCalendarCore::Incidence::Ptr &incidence)
+{
+    if (incidence->hasRecurrenceId()) {
+        return incidence->uid() + QLatin1Char('\n')
+            + QString::number(incidence->recurrenceId().toMSecsSinceEpoch());
+    }
+    return incidence->uid();
+}
+
+bool OccurrenceIndex::contains(const KCalendarCore::Incidence::Ptr &incidence) const
+{
+    const QHash<QString, Entry>::ConstIterator it = mEntries.constFind(key(incidence));
+    return it != mEntries.constEnd()
+        && it->fingerprint == IcsStreamParser::fingerprint(incidence);
+}
+
+void OccurrenceIndex::insert(const KCalendarCore::Incidence::Ptr &incidence)
+{
+    Entry entry;
+    entry.uid = incidence->uid();
+    entry.recurrenceId = incidence->hasRecurrenceId()
+        ? incidence->recurrenceId().toMSecsSinceEpoch() : 0;
+    entry.fingerprint = IcsStreamParser::fingerprint(incidence);
+
+    const QDateTime dtStart = incidence->dtStart();
+    const QDateTime dtEnd = incidence->dateTime(KCalendarCore::Incidence::RoleEnd);
+    entry.duration = dtStart.isValid() && dtEnd.isValid() ? dtStart.msecsTo(dtEnd) : 0;
+
+    if (incidence->recurs()) {
+        // Start a bit earlier, for occurrences still running at the window start.
+        const QDateTime from = mStart.addMSecs(-entry.duration);
+        for (const QDateTime &occurrence : incidence->recurrence()->timesInInterval(from, mEnd)) {
+            entry.starts.append(occurrence.toMSecsSinceEpoch());
+        }
+    } else if (dtStart.isValid()) {
+        const qint64 start = dtStart.toMSecsSinceEpoch();
+        if (start < mEnd.toMSecsSinceEpoch()
+            && start + entry.duration >= mStart.toMSecsSinceEpoch()) {
+            entry.starts.append(start);
+        }
+    }
+    // Keep empty entries too, they tell that the incidence is up to date.
+    mEntries.insert(key(incidence), entry);
+}
+
+void OccurrenceIndex::remove(const KCalendarCore::Incidence::Ptr &incidence)
+{
+    mEntries.remove(key(incidence));
+}
+
+int OccurrenceIndex::count() const
+{
+    return mEntries.count();
+}
+
+QList<OccurrenceIndex::Occurrence> OccurrenceIndex::occurrences(const QDateTime &start,
+                                                                const QDateTime &end) const
+{
+    const qint64 from = start.toMSecsSinceEpoch();
+    const qint64 to = end.toMSecsSinceEpoch();
+
+    QSet<QString> exceptions;
+    for (const Entry &entry : mEntries) {
+        if (entry.recurrenceId) {
+            exceptions.insert(entry.uid + QLatin1Char('\n') + QString::number(entry.recurrenceId));
+        }
+    }
+
+    QList<Occurrence> list;
+    for (const Entry &entry : mEntries) {
+        for (qint64 occurrence : entry.starts) {
+            if (occurrence >= to || occurrence + entry.duration < from) {
+                continue;
+            }
+            if (!entry.recurrenceId
+                && exceptions.contains(entry.uid + QLatin1Char('\n') + QString::number(occurrence))) {
+                continue;
+            }
+            list.append(Occurrence{entry.uid,
+                                   QDateTime::fromMSecsSinceEpoch(occurrence, Qt::UTC),
+                                   QDateTime::fromMSecsSinceEpoch(occurrence + entry.duration, Qt::UTC)});
+        }
+    }
+    std::sort(list.begin(), list.end(), [](const Occurrence &a, const Occurrence &b) {
+            return a.start < b.start || (a.start == b.start && a.uid < b.uid);
+        });
+    return list;
+}
@@ -0,0 +1,100 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef OCCURRENCEINDEX_H
+#define OCCURRENCEINDEX_H
+
+#include <KCalendarCore/Incidence>
+
+#include <QDateTime>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QVector>
+
+/*! \brief Pre-computed occurrences of the incidences of a notebook
+ *
+ * Occurrences within a time window are expanded once at import time
+ * and stored in a compact sidecar file per notebook, so range queries
+ * do not need to expand recurrences. Entries are keyed by incidence,
+ * with their fingerprint, so only changed incidences are expanded
+ * again by later syncs.
+ */
+class OccurrenceIndex
+{
+public:
+    struct Occurrence {
+        QString uid;
+        QDateTime start;
+        QDateTime end;
+    };
+
+    OccurrenceIndex();
+
+    /*! \brief Path of the index of a notebook */
+    static QString path(const QString &notebookUid);
+
+    /*! \brief Deletes the index of a notebook */
+    static void remove(const QString &notebookUid);
+
+    /*! \brief Loads the index of a notebook */
+    bool load(const QString &notebookUid);
+
+    /*! \brief Saves the index for a notebook */
+    bool save(const QString &notebookUid) const;
+
+    /*! \brief Changes the window, all entries are dropped if it differs */
+    void setWindow(const QDateTime &start, const QDateTime &end);
+    QDateTime windowStart() const;
+    QDateTime windowEnd() const;
+
+    /*! \brief Checks if an incidence is indexed with its current content */
+    bool contains(const KCalendarCore::Incidence::Ptr &incidence) const;
+
+    /*! \brief Expands and stores the occurrences of an incidence */
+    void insert(const KCalendarCore::Incidence::Ptr &incidence);
+
+    /*! \brief Removes the occurrences of an incidence */
+    void remove(const KCalendarCore::Incidence::Ptr &incidence);
+
+    /*! \brief Number of indexed incidences */
+    int count() const;
+
+    /*! \brief Occurrences overlapping the given range, sorted by start,
+     *  exceptions replacing the occurrences of their parent */
+    QList<Occurrence> occurrences(const QDateTime &start, const QDateTime &end) const;
+
+private:
+    struct Entry {
+        QString uid;
+        qint64 recurrenceId = 0;
+        QString fingerprint;
+        qint64 duration = 0;
+        QVector<qint64> starts;
+    };
+    static QString key(const KCalendarCore::Incidence::Ptr &incidence);
+
+    QDateTime mStart;
+    QDateTime mEnd;
+    QHash<QString, Entry> mEntries;
+};
+
+#endif // OCCURRENCEINDEX_H
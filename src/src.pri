@@ -1,17 +1,48 @@
 QT -= gui
-QT += network dbus
+QT += network dbus concurrent
 
 CONFIG += link_pkgconfig c++11
 
-PKGCONFIG += buteosyncfw5 KF5CalendarCore libmkcal-qt5
+PKGCONFIG += buteosyncfw5 KF5CalendarCore libmkcal-qt5 zlib
+
+# Disabled with CONFIG+=no_brotli, see the brotli build
+# condition of the package.
+!no_brotli {
+    PKGCONFIG += libbrotlidec
+    DEFINES += HAVE_BROTLI
+}
 
 INCLUDEPATH += $$PWD
 
 SOURCES += \
-        $$PWD/webcalclient.cpp
+        $$PWD/webcalclient.cpp \
+        $$PWD/icsstreamparser.cpp \
+        $$PWD/incidencefilter.cpp \
+        $$PWD/contentdecoder.cpp \
+        $$PWD/downloadspool.cpp \
+        $$PWD/synchistory.cpp \
+        $$PWD/changehistory.cpp \
+        $$PWD/occurrenceindex.cpp \
+        $$PWD/timezonecache.cpp \
+        $$PWD/componentindex.cpp \
+        $$PWD/stringpool.cpp \
+        $$PWD/feedbudget.cpp \
+        $$PWD/feedrecord.cpp
 
 HEADERS += \
-        $$PWD/webcalclient.h
+        $$PWD/webcalclient.h \
+        $$PWD/icsstreamparser.h \
+        $$PWD/incidencefilter.h \
+        $$PWD/contentdecoder.h \
+        $$PWD/downloadspool.h \
+        $$PWD/synchistory.h \
+        $$PWD/changehistory.h \
+        $$PWD/occurrenceindex.h \
+        $$PWD/timezonecache.h \
+        $$PWD/componentindex.h \
+        $$PWD/stringpool.h \
+        $$PWD/feedbudget.h \
+        $$PWD/feedrecord.h
 
 OTHER_FILES += \
         $$PWD/xmls/webcal.xml \
@@ -0,0 +1,82 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "stringpool.h"
+
+StringPool::StringPool()
+    : mHits(0)
+{
+}
+
+QString StringPool::intern(const QString &value)
+{
+    if (value.isEmpty()) {
+        return value;
+    }
+    QSet<QString>::ConstIterator it = mStrings.constFind(value);
+    if (it == mStrings.constEnd()) {
+        mStrings.insert(value);
+        return value;
+    }
+    mHits += 1;
+    return *it;
+}
+
+void StringPool::intern(const KCalendarCore::Incidence::Ptr &incidence)
+{
+    // Setters are skipped for empty values only, every other value
+    // is replaced by its shared instance, even when seen first.
+    if (!incidence->categories().isEmpty()) {
+        QStringList categories = incidence->categories();
+        for (QString &category : categories) {
+            category = intern(category);
+        }
+        incidence->setCategories(categories);
+    }
+    if (!incidence->location().isEmpty()) {
+        incidence->setLocation(intern(incidence->location()), incidence->locationIsRich());
+    }
+    const KCalendarCore::Person organizer = incidence->organizer();
+    if (!organizer.isEmpty()) {
+        incidence->setOrganizer(KCalendarCore::Person(intern(organizer.name()),
+                                                      intern(organizer.email())));
+    }
+    QMap<QByteArray, QString> properties = incidence->customProperties();
+    if (!properties.isEmpty()) {
+        for (QMap<QByteArray, QString>::Iterator it = properties.begin(); it != properties.end(); ++it) {
+            // Application properties, like fingerprints, are unique.
+            if (!it.key().startsWith("X-KDE-")) {
+                it.value() = intern(it.value());
+            }
+        }
+        incidence->setCustomProperties(properties);
+    }
+}
+
+int StringPool::count() const
+{
+    return mStrings.count();
+}
+
+int StringPool::hits() const
+{
+    return mHits;
+}
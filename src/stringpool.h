@@ -0,0 +1,64 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef STRINGPOOL_H
+#define STRINGPOOL_H
+
+#include <KCalendarCore/Incidence>
+
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+/*! \brief Interning table for the strings of imported incidences
+ *
+ * Feeds repeat the same categories, locations, organizers and
+ * custom property values on many incidences. Each parsed incidence
+ * holds its own copy of them, the pool makes equal values share one
+ * implicitly shared QString instead, so the duplicates are released
+ * as soon as an incidence is interned.
+ *
+ * A pool lives for one import, it is not thread safe.
+ */
+class StringPool
+{
+public:
+    StringPool();
+
+    /*! \brief Shared instance of a string equal to value */
+    QString intern(const QString &value);
+
+    /*! \brief Makes the repeated properties of an incidence
+     *  use the shared instances of their values */
+    void intern(const KCalendarCore::Incidence::Ptr &incidence);
+
+    /*! \brief Number of distinct strings in the pool */
+    int count() const;
+
+    /*! \brief Number of strings replaced by a shared instance */
+    int hits() const;
+
+private:
+    QSet<QString> mStrings;
+    int mHits;
+};
+
+#endif // STRINGPOOL_H
@@ -0,0 +1,91 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "synchistory.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QLoggingCategory>
+
+Q_DECLARE_LOGGING_CATEGORY(lcWebCal)
+
+static const int MAX_RECORDS = 50;
+
+SyncHistory::SyncHistory(const QString &profileName)
+    : mPath(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+            + QStringLiteral("/webcal/") + profileName + QStringLiteral("-history.json"))
+{
+}
+
+QString SyncHistory::path() const
+{
+    return mPath;
+}
+
+QJsonArray SyncHistory::records() const
+{
+    QFile file(mPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QJsonArray();
+    }
+    return QJsonDocument::fromJson(file.readAll()).array();
+}
+
+bool SyncHistory::append(const QJsonObject &record)
+{
+    QJsonArray history = records();
+    history.append(record);
+    while (history.size() > MAX_RECORDS) {
+        history.removeFirst();
+    }
+
+    QDir().mkpath(QFileInfo(mPath).absolutePath());
+    QSaveFile file(mPath);
+    if (!file.open(QIODevice::WriteOnly)
+        || file.write(QJsonDocument(history).toJson(QJsonDocument::Compact)) < 0
+        || !file.commit()) {
+        qCWarning(lcWebCal) << "Cannot write sync history" << mPath;
+        return false;
+    }
+    return true;
+}
+
+qint64 SyncHistory::peakMemory()
+{
+    QFile status(QStringLiteral("/proc/self/status"));
+    if (!status.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+    for (const QByteArray &line : status.readAll().split('\n')) {
+        if (line.startsWith("VmHWM:")) {
+            QByteArray value = line.mid(6).trimmed();
+            if (value.endsWith(" kB")) {
+                value.chop(3);
+            }
+            return value.toLongLong() * 1024;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,59 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef SYNCHISTORY_H
+#define SYNCHISTORY_H
+
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QString>
+
+/*! \brief Rolling history of the statistics of the syncs of a profile
+ *
+ * Every sync produces a structured record with the duration of its
+ * phases and its counters. The last records of a profile are kept in
+ * a JSON file of the cache directory, for later diagnosis.
+ */
+class SyncHistory
+{
+public:
+    /*! \brief History of the given profile */
+    explicit SyncHistory(const QString &profileName);
+
+    /*! \brief Path of the history file */
+    QString path() const;
+
+    /*! \brief Stored records, from the oldest to the newest */
+    QJsonArray records() const;
+
+    /*! \brief Appends a record, dropping the oldest ones
+     *  beyond the size of the history */
+    bool append(const QJsonObject &record);
+
+    /*! \brief Peak resident memory of the process, in bytes,
+     *  or -1 if not available */
+    static qint64 peakMemory();
+
+private:
+    QString mPath;
+};
+
+#endif // SYNCHISTORY_H
@@ -0,0 +1,166 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "timezonecache.h"
+#include "icsstreamparser.h"
+
+#include <KCalendarCore/ICalFormat>
+#include <KCalendarCore/MemoryCalendar>
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QTimeZone>
+#include <QLoggingCategory>
+
+Q_DECLARE_LOGGING_CATEGORY(lcWebCal)
+
+static const quint32 CACHE_MAGIC = 0x5743545a; // WCTZ
+static const quint32 CACHE_VERSION = 1;
+
+// The cache is started again when growing larger than this.
+static const int MAX_ENTRIES = 512;
+
+TimezoneCache::TimezoneCache()
+    : mLoaded(false)
+    , mModified(false)
+    , mHits(0)
+    , mMisses(0)
+{
+}
+
+QString TimezoneCache::path()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+        + QStringLiteral("/webcal/timezones");
+}
+
+bool TimezoneCache::load()
+{
+    if (mLoaded) {
+        return true;
+    }
+    mLoaded = true;
+
+    QFile file(path());
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+    quint32 magic, version;
+    stream >> magic >> version;
+    if (magic != CACHE_MAGIC || version != CACHE_VERSION) {
+        return false;
+    }
+    QHash<QByteArray, QByteArray> ids;
+    stream >> ids;
+    if (stream.status() != QDataStream::Ok) {
+        qCWarning(lcWebCal) << "Corrupted time zone cache" << file.fileName();
+        return false;
+    }
+    // Keep what was resolved before loading.
+    ids.unite(mIds);
+    mIds.swap(ids);
+    return true;
+}
+
+bool TimezoneCache::save()
+{
+    if (!mModified) {
+        return true;
+    }
+    const QString filePath = path();
+    QDir().mkpath(QFileInfo(filePath).absolutePath());
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(lcWebCal) << "Cannot write time zone cache" << filePath;
+        return false;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream << CACHE_MAGIC << CACHE_VERSION << mIds;
+    if (!file.commit()) {
+        return false;
+    }
+    mModified = false;
+    return true;
+}
+
+QByteArray TimezoneCache::resolve(const QByteArray &tzid, const QByteArray &definition,
+                                  const QByteArray &fingerprint)
+{
+    QHash<QByteArray, QByteArray>::ConstIterator it = mIds.constFind(fingerprint);
+    if (it != mIds.constEnd()) {
+        mHits += 1;
+        return it.value();
+    }
+    mMisses += 1;
+
+    // Let KCalendarCore resolve the definition for an event using it,
+    // so the result is the same as when parsing the definition.
+    QByteArray data("BEGIN:VCALENDAR\r\nVERSION:2.0\r\nPRODID:-//webcal//timezone//EN\r\n");
+    data.append(definition);
+    data.append("BEGIN:VEVENT\r\nUID:webcal-timezone\r\nDTSTAMP:20000101T000000Z\r\n"
+                "DTSTART;TZID=\"" + tzid + "\":20000101T000000\r\n"
+                "END:VEVENT\r\nEND:VCALENDAR\r\n");
+    KCalendarCore::MemoryCalendar::Ptr calendar(new KCalendarCore::MemoryCalendar(QTimeZone::utc()));
+    KCalendarCore::ICalFormat iCalFormat;
+    QByteArray id;
+    // Batches of the parser may be registering time zones meanwhile.
+    QMutexLocker lock(IcsStreamParser::formatLock());
+    const bool parsed = iCalFormat.fromRawString(calendar, data);
+    lock.unlock();
+    if (parsed && calendar->incidences().count() == 1) {
+        id = calendar->incidences().first()->dtStart().timeZone().id();
+    }
+    if (!id.isEmpty() && !QTimeZone::isTimeZoneIdAvailable(id)) {
+        // A time zone built from the definition only.
+        id.clear();
+    }
+    qCDebug(lcWebCal) << "Time zone" << tzid << "resolved to" << id;
+
+    if (mIds.count() >= MAX_ENTRIES) {
+        mIds.clear();
+    }
+    mIds.insert(fingerprint, id);
+    mModified = true;
+    return id;
+}
+
+int TimezoneCache::count() const
+{
+    return mIds.count();
+}
+
+int TimezoneCache::hits() const
+{
+    return mHits;
+}
+
+int TimezoneCache::misses() const
+{
+    return mMisses;
+}
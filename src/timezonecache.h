@@ -0,0 +1,83 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef TIMEZONECACHE_H
+#define TIMEZONECACHE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+
+/*! \brief Time zones resolved from VTIMEZONE definitions
+ *
+ * KCalendarCore resolves every VTIMEZONE definition to a system time
+ * zone, matching non standard TZIDs on their transitions, which is
+ * slow. Feeds repeat the same definitions on every sync, so the
+ * resolved time zone ids are kept by fingerprint of the definitions,
+ * in a file shared by all profiles. A definition known to the cache
+ * does not need to be parsed anymore: components refer directly to
+ * the system time zone instead.
+ *
+ * Definitions that cannot be resolved are cached too, with an empty
+ * id, so they are not tried again.
+ */
+class TimezoneCache
+{
+public:
+    TimezoneCache();
+
+    /*! \brief File where the cache is stored */
+    static QString path();
+
+    /*! \brief Reads the cache, if not read yet */
+    bool load();
+
+    /*! \brief Writes the cache, if entries were added since loaded */
+    bool save();
+
+    /*! \brief System time zone id of a VTIMEZONE definition
+     *
+     * @param tzid the TZID of the definition
+     * @param definition the VTIMEZONE component, as content lines
+     * @param fingerprint hash of the definition
+     * @return the time zone id, empty if it cannot be resolved
+     */
+    QByteArray resolve(const QByteArray &tzid, const QByteArray &definition,
+                       const QByteArray &fingerprint);
+
+    /*! \brief Number of cached definitions */
+    int count() const;
+
+    /*! \brief Number of definitions found in the cache by resolve() */
+    int hits() const;
+
+    /*! \brief Number of definitions resolved by parsing them */
+    int misses() const;
+
+private:
+    QHash<QByteArray, QByteArray> mIds;
+    bool mLoaded;
+    bool mModified;
+    int mHits;
+    int mMisses;
+};
+
+#endif // TIMEZONECACHE_H
@@ -21,17 +21,48 @@
  */
 
 #include "webcalclient.h"
+#include "synchistory.h"
+#include "changehistory.h"
+#include "occurrenceindex.h"
+#include "feedrecord.h"
 
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 #include <QDateTime>
+#include <QTimer>
+#include <QThread>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QSet>
 
 #include <PluginCbInterface.h>
 
-#include <KCalendarCore/ICalFormat>
+#include <functional>
+
 
 Q_LOGGING_CATEGORY(lcWebCal, "buteo.plugin.webcal", QtWarningMsg)
 
+namespace {
+// Runs a task in its own thread, without event loop.
+class TaskThread : public QThread
+{
+public:
+    explicit TaskThread(const std::function<void()> &task)
+        : mTask(task)
+    {
+    }
+
+protected:
+    void run() override
+    {
+        mTask();
+    }
+
+private:
+    std::function<void()> mTask;
+};
+}
+
 Buteo::ClientPlugin* WebCalClientLoader::createClientPlugin(
         const QString& pluginName,
         const Buteo::SyncProfile& profile,
@@ -45,18 +76,59 @@ WebCalClient::WebCalClient(const QString& aPluginName,
                            const Buteo::SyncProfile& aProfile,
                            Buteo::PluginCbInterface *aCbInterface)
     : ClientPlugin(aPluginName, aProfile, aCbInterface)
+    , mClient(nullptr)
+    , mOccurrenceDays(0)
     , mCalendar(nullptr)
     , mStorage(nullptr)
-    , mReply(nullptr)
+    , mRecorded(false)
+    , mNetworkManager(nullptr)
+    , mImportThread(nullptr)
+    , mCancelled(0)
+    , mSaveNs(0)
 {
 }
 
 WebCalClient::~WebCalClient()
 {
-    delete mReply;
+    stopImport();
+    for (Feed *feed : mFeeds) {
+        delete feed->reply;
+    }
+    qDeleteAll(mFeeds);
 }
 
+static const QByteArray URL_PROPERTY("url");
 static const QByteArray ETAG_PROPERTY("etag");
+static const QByteArray LAST_MODIFIED_PROPERTY("last-modified");
+static const QByteArray DIGEST_PROPERTY("digest");
+static const QByteArray UNCHANGED_PROPERTY("unchanged-syncs");
+static const QByteArray FILTER_PROPERTY("filter");
+static const QByteArray WINDOW_START_PROPERTY("window-start");
+static const QByteArray WINDOW_END_PROPERTY("window-end");
+static const QByteArray STAGING_PROPERTY("staging-for");
+static const QByteArray REPLACED_PROPERTY("replaced-by");
+static const QByteArray FINAL_URL_PROPERTY("final-url");
+static const QByteArray CALENDAR_NAME_PROPERTY("calendar-name");
+static const QByteArray HISTORY_PROPERTY("change-history");
+static const QByteArray SYNC_INTERVAL_PROPERTY("sync-interval");
+static const QByteArray TRANSFERRED_BYTES_PROPERTY("transferred-bytes");
+static const QByteArray CONTENT_BYTES_PROPERTY("content-bytes");
+
+// Content synced by another profile more recently than
+// this is reused without asking the server.
+static const qint64 DONOR_MAX_AGE = 15 * 60;
+
+// Number of changes saved at once in storage.
+static const int DEFAULT_COMMIT_BATCH_SIZE = 500;
+
+// Smaller responses are downloaded again from scratch.
+static const qint64 SPOOL_THRESHOLD = 256 * 1024;
+
+// Size of the buffer responses are read into.
+static const int READ_BUFFER_SIZE = 65536;
+
+// At most this much of an error response is logged.
+static const int ERROR_EXCERPT_SIZE = 512;
 bool WebCalClient::init()
 {
     emit syncProgressDetail(iProfile.name(), Sync::SYNC_PROGRESS_INITIALISING);
@@ -67,109 +139,509 @@ bool WebCalClient::init()
         return false;
     }
 
+    mFilter = IncidenceFilter(*mClient);
+    mBudget = FeedBudget(*mClient);
+    mTimezoneCache.load();
+    mOccurrenceDays = mClient->key(QStringLiteral("occurrenceDays")).toInt();
+
+    // A profile may list several remote calendars, synced together.
+    QStringList urls = mClient->keyValues(QStringLiteral("remoteCalendar"));
+    if (urls.isEmpty()) {
+        urls << QString();
+    }
+    const QStringList labels = mClient->keyValues(QStringLiteral("label"));
+    qDeleteAll(mFeeds);
+    mFeeds.clear();
+    for (int i = 0; i < urls.count(); i++) {
+        Feed *feed = new Feed;
+        feed->url = urls[i];
+        feed->label = labels.value(i);
+        mFeeds.append(feed);
+    }
+
+    mRecorded = loadRecord();
+    if (mRecorded) {
+        // Conditional requests only need the validators,
+        // storage is opened by commit() once responses are in.
+        qCDebug(lcWebCal) << "Using the feed record of" << getProfileName();
+        return true;
+    }
+    if (!openStorage()) {
+        return false;
+    }
+
+    // Look for already existing notebooks in storage for this sync profile,
+    // first by URL, then the ones created before several URLs were supported.
+    QList<mKCal::Notebook::Ptr> notebooks;
+    QList<mKCal::Notebook::Ptr> others;
+    for (mKCal::Notebook::Ptr notebook : mStorage->notebooks()) {
+        if (notebook->pluginName() != getPluginName()
+            || !notebook->customProperty(STAGING_PROPERTY).isEmpty()
+            || !notebook->customProperty(REPLACED_PROPERTY).isEmpty()) {
+            continue;
+        } else if (notebook->syncProfile() != getProfileName()) {
+            others.append(notebook);
+        } else {
+            notebooks.append(notebook);
+        }
+    }
+    // Syncs of unchanged feeds may not be written to the notebooks yet.
+    FeedRecord record;
+    record.load(getProfileName());
+    QHash<Feed*, mKCal::Notebook::Ptr> matches;
+    for (Feed *feed : mFeeds) {
+        for (int i = 0; i < notebooks.count() && !feed->url.isEmpty(); i++) {
+            if (notebooks[i]->customProperty(URL_PROPERTY) == feed->url) {
+                matches.insert(feed, notebooks.takeAt(i));
+                break;
+            }
+        }
+    }
+    for (Feed *feed : mFeeds) {
+        for (int i = 0; i < notebooks.count() && !matches.contains(feed); i++) {
+            if (mFeeds.count() == 1 || notebooks[i]->customProperty(URL_PROPERTY).isEmpty()) {
+                matches.insert(feed, notebooks.takeAt(i));
+            }
+        }
+    }
+
+    for (Feed *feed : mFeeds) {
+        mKCal::Notebook::Ptr notebook = matches.value(feed);
+        if (notebook) {
+            feed->notebookUid = notebook->uid();
+            feed->etag = notebook->customProperty(ETAG_PROPERTY).toUtf8();
+            feed->lastModified = notebook->customProperty(LAST_MODIFIED_PROPERTY).toUtf8();
+            feed->digest = notebook->customProperty(DIGEST_PROPERTY).toUtf8();
+            feed->finalUrl = notebook->customProperty(FINAL_URL_PROPERTY);
+            feed->filterSignature = notebook->customProperty(FILTER_PROPERTY).toLatin1();
+            feed->windowStart = QDateTime::fromString(notebook->customProperty(WINDOW_START_PROPERTY), Qt::ISODate);
+            feed->windowEnd = QDateTime::fromString(notebook->customProperty(WINDOW_END_PROPERTY), Qt::ISODate);
+            feed->history = notebook->customProperty(HISTORY_PROPERTY);
+            feed->unchangedSyncs = notebook->customProperty(UNCHANGED_PROPERTY).toInt();
+            feed->syncDate = notebook->syncDate();
+            for (const FeedRecord::Entry &entry : record.entries()) {
+                if (entry.notebookUid == feed->notebookUid && entry.syncDate > feed->syncDate) {
+                    feed->history = entry.history;
+                    feed->unchangedSyncs = entry.unchangedSyncs;
+                    feed->syncDate = entry.syncDate;
+                }
+            }
+            // When the time window moved out of what was imported
+            // previously, import again the missing incidences.
+            if (!mFilter.covers(feed->windowStart, feed->windowEnd)
+                || feed->filterSignature != mFilter.signature()) {
+                qCDebug(lcWebCal) << "Filter changed or time window not covered by"
+                                  << feed->windowStart << feed->windowEnd;
+                ComponentIndex::remove(feed->notebookUid);
+                feed->etag.clear();
+                feed->lastModified.clear();
+                feed->digest.clear();
+            }
+        } else {
+            // or create a new one
+            notebook = mKCal::Notebook::Ptr(new mKCal::Notebook(feed->label, QString()));
+            notebook->setPluginName(getPluginName());
+            notebook->setSyncProfile(getProfileName());
+            notebook->setCustomProperty(URL_PROPERTY, feed->url);
+            notebook->setIsReadOnly(true);
+            if (!mStorage->addNotebook(notebook)) {
+                qCWarning(lcWebCal) << "Cannot create a new notebook" << notebook->uid();
+                return false;
+            }
+            feed->notebookUid = notebook->uid();
+        }
+        qCDebug(lcWebCal) << "Using notebook" << feed->notebookUid << "for" << feed->url;
+        findDonor(feed, others);
+    }
+
+    return true;
+}
+
+bool WebCalClient::openStorage()
+{
     mCalendar = mKCal::ExtendedCalendar::Ptr(new mKCal::ExtendedCalendar(QTimeZone::utc()));
     mStorage = mKCal::ExtendedCalendar::defaultStorage(mCalendar);
     if (!mStorage || !mStorage->open()) {
         qCWarning(lcWebCal) << "Cannot open default storage.";
+        mStorage.clear();
         return false;
     }
-
-    // Look for an already existing notebook in storage for this sync profile.
-    for (mKCal::Notebook::Ptr notebook : mStorage->notebooks()) {
-        if (notebook->pluginName() == getPluginName() &&
-            notebook->syncProfile() == getProfileName()) {
-            mNotebookUid = notebook->uid();
-            mNotebookEtag = notebook->customProperty(ETAG_PROPERTY).toUtf8();
-            break;
+    // Drop what an import that did not complete left over. Imports
+    // mark the record first, there is nothing to look for otherwise.
+    FeedRecord record;
+    if (record.load(getProfileName()) && !record.isImporting()) {
+        return true;
+    }
+    QList<mKCal::Notebook::Ptr> staging;
+    QList<mKCal::Notebook::Ptr> replaced;
+    for (const mKCal::Notebook::Ptr &notebook : mStorage->notebooks()) {
+        if (notebook->pluginName() != getPluginName()
+            || notebook->syncProfile() != getProfileName()) {
+            continue;
+        } else if (!notebook->customProperty(STAGING_PROPERTY).isEmpty()) {
+            staging.append(notebook);
+        } else if (!notebook->customProperty(REPLACED_PROPERTY).isEmpty()) {
+            replaced.append(notebook);
         }
     }
-    if (mNotebookUid.isEmpty()) {
-        // or create a new one
-        mKCal::Notebook::Ptr notebook(new mKCal::Notebook(mClient->key("label"), QString()));
-        notebook->setPluginName(getPluginName());
-        notebook->setSyncProfile(getProfileName());
-        notebook->setIsReadOnly(true);
-        if (!mStorage->addNotebook(notebook)) {
-            qCWarning(lcWebCal) << "Cannot create a new notebook" << notebook->uid();
-            return false;
+    for (const mKCal::Notebook::Ptr &notebook : replaced) {
+        // Replaced notebooks are hidden before their replacement is
+        // promoted, see commitNotebook(): delete them once it is,
+        // otherwise show them again.
+        mKCal::Notebook::Ptr replacement = mStorage->notebook(notebook->customProperty(REPLACED_PROPERTY));
+        if (replacement && replacement->customProperty(STAGING_PROPERTY).isEmpty()) {
+            qCDebug(lcWebCal) << "Deleting replaced notebook" << notebook->uid();
+            if (mStorage->deleteNotebook(notebook)) {
+                OccurrenceIndex::remove(notebook->uid());
+                ComponentIndex::remove(notebook->uid());
+            }
+        } else {
+            qCDebug(lcWebCal) << "Restoring replaced notebook" << notebook->uid();
+            notebook->setIsVisible(true);
+            notebook->setCustomProperty(REPLACED_PROPERTY, QString());
+            mStorage->updateNotebook(notebook);
         }
-        mNotebookUid = notebook->uid();
     }
-    qCDebug(lcWebCal) << "Using notebook" << mNotebookUid;
+    for (const mKCal::Notebook::Ptr &notebook : staging) {
+        qCDebug(lcWebCal) << "Deleting staging notebook" << notebook->uid();
+        mStorage->deleteNotebook(notebook);
+    }
+    return true;
+}
 
+bool WebCalClient::loadRecord()
+{
+    FeedRecord record;
+    if (!record.load(getProfileName()) || record.isImporting()
+        || record.entries().count() != mFeeds.count()) {
+        return false;
+    }
+    const QList<FeedRecord::Entry> entries = record.entries();
+    for (int i = 0; i < mFeeds.count(); i++) {
+        // Notebooks to import again or to update
+        // with new settings are handled by the storage path.
+        if (entries[i].url != mFeeds[i]->url || entries[i].notebookUid.isEmpty()
+            || entries[i].filterSignature != mFilter.signature()
+            || !mFilter.covers(entries[i].windowStart, entries[i].windowEnd)
+            || entries[i].label != mFeeds[i]->label
+            || entries[i].account != iProfile.key("accountid")) {
+            return false;
+        }
+    }
+    for (int i = 0; i < mFeeds.count(); i++) {
+        Feed *feed = mFeeds[i];
+        feed->notebookUid = entries[i].notebookUid;
+        feed->etag = entries[i].etag;
+        feed->lastModified = entries[i].lastModified;
+        feed->digest = entries[i].digest;
+        feed->finalUrl = entries[i].finalUrl;
+        feed->filterSignature = entries[i].filterSignature;
+        feed->windowStart = entries[i].windowStart;
+        feed->windowEnd = entries[i].windowEnd;
+        feed->name = entries[i].name;
+        feed->history = entries[i].history;
+        feed->unchangedSyncs = entries[i].unchangedSyncs;
+        feed->syncDate = entries[i].syncDate;
+        feed->donorUid.clear();
+    }
     return true;
 }
 
+void WebCalClient::saveRecord()
+{
+    FeedRecord record;
+    for (const Feed *feed : mFeeds) {
+        if (!feed->donorUid.isEmpty()) {
+            // Shared feeds look for the other profiles on each sync.
+            FeedRecord::remove(getProfileName());
+            return;
+        }
+        FeedRecord::Entry entry;
+        entry.url = feed->url;
+        entry.notebookUid = feed->notebookUid;
+        entry.etag = feed->etag;
+        entry.lastModified = feed->lastModified;
+        entry.digest = feed->digest;
+        entry.finalUrl = feed->finalUrl;
+        entry.filterSignature = feed->filterSignature;
+        entry.windowStart = feed->windowStart;
+        entry.windowEnd = feed->windowEnd;
+        entry.label = feed->label;
+        entry.account = iProfile.key("accountid");
+        entry.name = feed->name;
+        entry.history = feed->history;
+        entry.unchangedSyncs = feed->unchangedSyncs;
+        entry.syncDate = feed->syncDate;
+        record.append(entry);
+    }
+    record.save(getProfileName());
+}
+
+void WebCalClient::findDonor(Feed *feed, const QList<mKCal::Notebook::Ptr> &notebooks)
+{
+    // Other profiles may subscribe to the same feed, possibly through
+    // another URL redirecting to it. Their content can be reused when
+    // it was imported with the same filter.
+    const QString windowStart = mFilter.windowStart().toString(Qt::ISODate);
+    const QString windowEnd = mFilter.windowEnd().toString(Qt::ISODate);
+    const QString signature = QString::fromLatin1(mFilter.signature());
+    mKCal::Notebook::Ptr donor;
+    for (const mKCal::Notebook::Ptr &notebook : notebooks) {
+        const QString url = notebook->customProperty(URL_PROPERTY);
+        const QString finalUrl = notebook->customProperty(FINAL_URL_PROPERTY);
+        const bool sameFeed = (!feed->url.isEmpty() && (url == feed->url || finalUrl == feed->url))
+            || (!feed->finalUrl.isEmpty() && finalUrl == feed->finalUrl);
+        if (sameFeed
+            && !notebook->customProperty(DIGEST_PROPERTY).isEmpty()
+            && notebook->customProperty(FILTER_PROPERTY) == signature
+            && notebook->customProperty(WINDOW_START_PROPERTY) == windowStart
+            && notebook->customProperty(WINDOW_END_PROPERTY) == windowEnd
+            && (!donor || notebook->syncDate() > donor->syncDate())) {
+            donor = notebook;
+        }
+    }
+    feed->donorUid.clear();
+    if (donor) {
+        qCDebug(lcWebCal) << feed->url << "is also synced in" << donor->uid();
+        feed->donorUid = donor->uid();
+        feed->donorEtag = donor->customProperty(ETAG_PROPERTY).toUtf8();
+        feed->donorLastModified = donor->customProperty(LAST_MODIFIED_PROPERTY).toUtf8();
+        feed->donorDigest = donor->customProperty(DIGEST_PROPERTY).toUtf8();
+        feed->donorFinalUrl = donor->customProperty(FINAL_URL_PROPERTY);
+        feed->donorCalendarName = donor->customProperty(CALENDAR_NAME_PROPERTY);
+        feed->donorDescription = donor->description();
+        feed->donorSyncDate = donor->syncDate();
+    }
+}
+
 bool WebCalClient::uninit()
 {
+    stopImport();
     qCDebug(lcWebCal) << "Closing storage.";
     if (mStorage) {
         mStorage->close();
     }
-    mCalendar->close();
+    if (mCalendar) {
+        mCalendar->close();
+    }
 
     return true;
 }
 
 bool WebCalClient::startSync()
 {
-    QNetworkRequest request(mClient->key("remoteCalendar"));
+    // Use a single access manager for all feeds, so connections
+    // to the same server are reused.
+    if (!mNetworkManager) {
+        mNetworkManager = new QNetworkAccessManager(this);
+    }
+    mElapsed.start();
+    mCancelled.storeRelease(0);
+
+    bool requested = false;
+    for (Feed *feed : mFeeds) {
+        feed->state = Feed::Pending;
+        feed->errorCode = Buteo::SyncResults::NO_ERROR;
+        feed->errorMessage.clear();
+        feed->hasContent = false;
+        feed->useDonor = false;
+        feed->decoder.reset();
+        feed->transferredBytes = 0;
+        feed->contentBytes = 0;
+        feed->connectNs = feed->downloadNs = feed->parseNs = feed->diffNs = 0;
+        feed->parsed = feed->filtered = feed->skipped = feed->componentCount = 0;
+        feed->exceeded = FeedBudget::None;
+        feed->cacheLifetime = -1;
+        feed->retried = false;
+        feed->committed = false;
+
+        if (!feed->donorUid.isEmpty()
+            && feed->donorSyncDate.secsTo(QDateTime::currentDateTimeUtc()) < DONOR_MAX_AGE) {
+            // Another profile just downloaded this feed.
+            processDonor(feed);
+            continue;
+        }
+
+        QByteArray etag = feed->etag;
+        QByteArray lastModified = feed->lastModified;
+        if (!feed->donorUid.isEmpty() && feed->donorDigest != feed->digest) {
+            // Another profile has a different version, check that one:
+            // if it is not modified, its content is reused.
+            etag = feed->donorEtag;
+            lastModified = feed->donorLastModified;
+            feed->useDonor = true;
+        }
+        requestFeed(feed, etag, lastModified);
+        requested = true;
+    }
+    if (!requested) {
+        // Finish asynchronously anyway.
+        QTimer::singleShot(0, this, [this] {
+                syncFinished();
+            });
+    }
+
+    return true;
+}
+
+void WebCalClient::requestFeed(Feed *feed, const QByteArray &etag, const QByteArray &lastModified)
+{
+    QNetworkRequest request(QUrl(feed->url));
     request.setAttribute(QNetworkRequest::FollowRedirectsAttribute,
                          mClient->boolKey("allowRedirect"));
-    if (!mNotebookEtag.isEmpty()) {
-        request.setRawHeader("If-None-Match", mNotebookEtag);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 8, 0)
+    request.setAttribute(QNetworkRequest::HTTP2AllowedAttribute, true);
+#endif
+    if (!etag.isEmpty()) {
+        request.setRawHeader("If-None-Match", etag);
     }
-    qCDebug(lcWebCal) << "Requesting" << request.url() << mNotebookEtag;
+    if (!lastModified.isEmpty()) {
+        request.setRawHeader("If-Modified-Since", lastModified);
+    }
+    feed->spool.reset(new DownloadSpool(feed->notebookUid));
+    if (feed->spool->isResumable()) {
+        request.setRawHeader("Range", "bytes=" + QByteArray::number(feed->spool->size()) + '-');
+        request.setRawHeader("If-Range", feed->spool->validator());
+    }
+    // Setting the header ourselves disables the transparent
+    // decompression of Qt, the content is decoded while parsing.
+    request.setRawHeader("Accept-Encoding", ContentDecoder::acceptedEncodings());
+    qCDebug(lcWebCal) << "Requesting" << request.url() << etag << lastModified;
 
-    QNetworkAccessManager *accessManager = new QNetworkAccessManager(this);
-    mReply = accessManager->get(request);
-    connect(mReply, &QNetworkReply::finished, [this] {
-            emit syncProgressDetail(iProfile.name(), Sync::SYNC_PROGRESS_FINALISING);
-            mReply->deleteLater();
-            if (mReply->error() != QNetworkReply::NoError
-                && mReply->error() != QNetworkReply::OperationCanceledError) {
-                qCWarning(lcWebCal) << mReply->readAll();
-                failed(Buteo::SyncResults::CONNECTION_ERROR,
-                       QStringLiteral("Network issue: %1.").arg(mReply->error()));
-            } else if (mReply->error() == QNetworkReply::NoError) {
-                processData(mReply->readAll(), mReply->rawHeader("etag"));
+    feed->requestTimer.start();
+    feed->reply = mNetworkManager->get(request);
+    connect(feed->reply, &QNetworkReply::metaDataChanged, this, [feed] {
+            // Headers received: name resolution, connection,
+            // TLS handshake and server processing are done.
+            if (!feed->connectNs) {
+                feed->connectNs = feed->requestTimer.nsecsElapsed();
             }
-            mReply = nullptr;
         });
-    connect(mReply, &QIODevice::readyRead, this, &WebCalClient::dataReceived);
-    
-    return true;
+    connect(feed->reply, &QNetworkReply::finished, this, [this, feed] {
+            replyFinished(feed);
+        });
+    connect(feed->reply, &QIODevice::readyRead, this, [this, feed] {
+            dataReceived(feed);
+        });
 }
 
 void WebCalClient::abortSync(Sync::SyncStatus aStatus)
 {
     Q_UNUSED(aStatus);
 
+    mCancelled.storeRelease(1);
+    if (mImportThread) {
+        // The import stops at the next component or batch,
+        // importFinished() then reports the abort.
+        qCDebug(lcWebCal) << "Cancelling import.";
+        return;
+    }
     failed(Buteo::SyncResults::ABORTED, QStringLiteral("Synchronization aborted."));
-    if (mReply) {
-        mReply->abort();
+    for (Feed *feed : mFeeds) {
+        if (feed->reply) {
+            feed->reply->abort();
+        }
     }
 }
 
-void WebCalClient::succeed(const QString &label, unsigned int added, unsigned int deleted)
+void WebCalClient::succeed()
 {
     mResults = Buteo::SyncResults(QDateTime::currentDateTime().toUTC(),
                                   Buteo::SyncResults::SYNC_RESULT_SUCCESS,
                                   Buteo::SyncResults::NO_ERROR);
-    if (added || deleted) {
-        mResults.addTargetResults
-            (Buteo::TargetResults(label.isEmpty() ? mNotebookUid : label,
-                                  Buteo::ItemCounts(added, deleted, 0),
-                                  Buteo::ItemCounts()));
+    for (const Feed *feed : mFeeds) {
+        if (feed->added || feed->modified || feed->deleted) {
+            mResults.addTargetResults
+                (Buteo::TargetResults(feed->name.isEmpty() ? feed->notebookUid : feed->name,
+                                      Buteo::ItemCounts(feed->added, feed->deleted, feed->modified),
+                                      Buteo::ItemCounts()));
+        }
     }
-    emit success(iProfile.name(), QStringLiteral("Remote calendar updated successfully."));
+    recordStatistics();
+    report(QStringLiteral("Remote calendar updated successfully."));
 }
 
 void WebCalClient::failed(Buteo::SyncResults::MinorCode code, const QString &message)
 {
     mResults = Buteo::SyncResults(QDateTime::currentDateTime().toUTC(),
                                   Buteo::SyncResults::SYNC_RESULT_FAILED, code);
-    emit error(iProfile.name(), message, code);
+    recordStatistics();
+    report(message);
+}
+
+void WebCalClient::report(const QString &message)
+{
+    if (QThread::currentThread() != thread()) {
+        // Reported by importFinished(), from the plugin thread.
+        mResultMessage = message;
+        return;
+    }
+    if (mResults.majorCode() == Buteo::SyncResults::SYNC_RESULT_SUCCESS) {
+        emit success(iProfile.name(), message);
+    } else {
+        emit error(iProfile.name(), message, mResults.minorCode());
+    }
+}
+
+static double milliseconds(qint64 nsecs)
+{
+    return nsecs / 1000000.;
+}
+
+void WebCalClient::recordStatistics()
+{
+    static const char *states[] = {"pending", "received", "not-modified", "modified", "failed"};
+
+    // Buteo::SyncResults only carries item counts,
+    // so timings go to a separate structured record.
+    QJsonArray feeds;
+    qint64 interval = 0;
+    for (const Feed *feed : mFeeds) {
+        if (feed->recommendedInterval > 0) {
+            interval = interval > 0 ? qMin(interval, feed->recommendedInterval) : feed->recommendedInterval;
+        }
+        QJsonObject stats;
+        stats.insert(QStringLiteral("url"), feed->url);
+        stats.insert(QStringLiteral("state"), QString::fromLatin1(states[feed->state]));
+        stats.insert(QStringLiteral("connectMs"), milliseconds(feed->connectNs));
+        stats.insert(QStringLiteral("downloadMs"), milliseconds(feed->downloadNs));
+        stats.insert(QStringLiteral("parseMs"), milliseconds(feed->parseNs));
+        stats.insert(QStringLiteral("diffMs"), milliseconds(feed->diffNs));
+        stats.insert(QStringLiteral("transferredBytes"), double(feed->transferredBytes));
+        stats.insert(QStringLiteral("contentBytes"), double(feed->contentBytes));
+        stats.insert(QStringLiteral("parsed"), feed->parsed);
+        stats.insert(QStringLiteral("filtered"), feed->filtered);
+        stats.insert(QStringLiteral("skipped"), feed->skipped);
+        stats.insert(QStringLiteral("components"), feed->componentCount);
+        stats.insert(QStringLiteral("added"), int(feed->added));
+        stats.insert(QStringLiteral("modified"), int(feed->modified));
+        stats.insert(QStringLiteral("deleted"), int(feed->deleted));
+        stats.insert(QStringLiteral("recommendedInterval"), double(feed->recommendedInterval));
+        if (feed->errorCode != Buteo::SyncResults::NO_ERROR) {
+            stats.insert(QStringLiteral("error"), feed->errorMessage);
+        }
+        if (feed->exceeded != FeedBudget::None) {
+            // What was read before the feed was cut is in the counters above.
+            stats.insert(QStringLiteral("exceededBudget"), FeedBudget::name(feed->exceeded));
+            stats.insert(QStringLiteral("budget"), double(mBudget.value(feed->exceeded)));
+        }
+        feeds.append(stats);
+    }
+    mStatistics = QJsonObject();
+    mStatistics.insert(QStringLiteral("date"), mResults.syncTime().toString(Qt::ISODate));
+    mStatistics.insert(QStringLiteral("majorCode"), int(mResults.majorCode()));
+    mStatistics.insert(QStringLiteral("minorCode"), int(mResults.minorCode()));
+    mStatistics.insert(QStringLiteral("totalMs"), mElapsed.isValid() ? double(mElapsed.elapsed()) : 0.);
+    mStatistics.insert(QStringLiteral("saveMs"), milliseconds(mSaveNs));
+    mStatistics.insert(QStringLiteral("peakMemory"), double(SyncHistory::peakMemory()));
+    mStatistics.insert(QStringLiteral("recommendedInterval"), double(interval));
+    mStatistics.insert(QStringLiteral("cachedTimezones"), mTimezoneCache.hits());
+    mStatistics.insert(QStringLiteral("resolvedTimezones"), mTimezoneCache.misses());
+    mStatistics.insert(QStringLiteral("feeds"), feeds);
+    qCDebug(lcWebCal) << "Sync statistics:"
+                      << QJsonDocument(mStatistics).toJson(QJsonDocument::Compact).constData();
+
+    SyncHistory(iProfile.name()).append(mStatistics);
 }
 
 Buteo::SyncResults WebCalClient::getSyncResults() const
@@ -179,103 +651,1104 @@ Buteo::SyncResults WebCalClient::getSyncResults() const
 
 bool WebCalClient::cleanUp()
 {
-    if (mNotebookUid.isEmpty()) {
+    if (mFeeds.isEmpty()) {
         init();
     }
-    qCDebug(lcWebCal) << "Deleting notebook" << mNotebookUid;
-    mKCal::Notebook::Ptr notebook = mStorage->notebook(mNotebookUid);
-    return !notebook || mStorage->deleteNotebook(notebook);
+    if (!mStorage && !openStorage()) {
+        return false;
+    }
+    FeedRecord::remove(getProfileName());
+    bool success = true;
+    for (const Feed *feed : mFeeds) {
+        qCDebug(lcWebCal) << "Deleting notebook" << feed->notebookUid;
+        DownloadSpool(feed->notebookUid).remove();
+        OccurrenceIndex::remove(feed->notebookUid);
+        ComponentIndex::remove(feed->notebookUid);
+        mKCal::Notebook::Ptr notebook = mStorage->notebook(feed->notebookUid);
+        success = (!notebook || mStorage->deleteNotebook(notebook)) && success;
+    }
+    return success;
 }
 
 void WebCalClient::connectivityStateChanged(Sync::ConnectivityType aType, bool aState)
 {
-    if (aType == Sync::CONNECTIVITY_INTERNET && !aState) {
-        // we lost connectivity during sync.
+    if (aType == Sync::CONNECTIVITY_INTERNET && !aState && !mImportThread) {
+        // we lost connectivity during sync, an import
+        // in progress does not need it anymore.
         abortSync(Sync::SYNC_CONNECTION_ERROR);
     }
 }
 
-void WebCalClient::dataReceived()
+void WebCalClient::dataReceived(Feed *feed)
 {
     emit syncProgressDetail(iProfile.name(), Sync::SYNC_PROGRESS_RECEIVING_ITEMS);
+
+    const QByteArray etag = feed->reply->rawHeader("etag");
+    if (!etag.isEmpty() && etag == feed->etag) {
+        // Server ignored If-None-Match, nothing to parse.
+        char discard[4096];
+        while (feed->reply->read(discard, sizeof(discard)) > 0) {
+        }
+        return;
+    }
+    if (!receiveData(feed, feed->reply)) {
+        feed->reply->abort();
+    }
 }
 
-void WebCalClient::processData(const QByteArray &icsData, const QByteArray &etag)
+void WebCalClient::replyFinished(Feed *feed)
 {
-    mKCal::Notebook::Ptr notebook = mStorage->notebook(mNotebookUid);
-    if (!notebook) {
-        failed(Buteo::SyncResults::DATABASE_FAILURE,
-               QStringLiteral("Cannot find notebook."));
+    QNetworkReply *reply = feed->reply;
+    feed->reply = nullptr;
+    reply->deleteLater();
+    feed->downloadNs = feed->requestTimer.nsecsElapsed() - feed->connectNs;
+    const QVariant status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute);
+    feed->cacheLifetime = ChangeHistory::cacheLifetime(reply->rawHeader("Cache-Control"),
+                                                       reply->rawHeader("Expires"),
+                                                       reply->rawHeader("Date"));
+    bool resumable = false;
+    if (feed->state == Feed::Pending) {
+        if (reply->error() == QNetworkReply::OperationCanceledError) {
+            resumable = true;
+            processError(feed, Buteo::SyncResults::ABORTED,
+                         QStringLiteral("Synchronization aborted."));
+        } else if (reply->error() != QNetworkReply::NoError) {
+            // Keep partial data only when the connection was lost
+            // while receiving the content, not on HTTP errors.
+            resumable = !status.isValid() || status.toInt() == 200 || status.toInt() == 206;
+            qCWarning(lcWebCal) << feed->url << "error response:" << reply->read(ERROR_EXCERPT_SIZE);
+            processError(feed, Buteo::SyncResults::CONNECTION_ERROR,
+                         QStringLiteral("Network issue: %1.").arg(reply->error()));
+        } else if (status.toInt() == 304 && feed->useDonor) {
+            processDonor(feed);
+        } else if (status.toInt() == 304) {
+            processNotModified(feed);
+        } else {
+            feed->finalUrl = reply->url().toString();
+            const QByteArray etag = reply->rawHeader("etag");
+            if ((!etag.isEmpty() && etag == feed->etag)
+                || receiveData(feed, reply)) {
+                // Parsed to the end by import().
+                feed->responseEtag = etag;
+                feed->responseLastModified = reply->rawHeader("Last-Modified");
+                feed->state = Feed::Received;
+            }
+        }
+    }
+    if (feed->spool) {
+        if (feed->state == Feed::Failed && resumable && feed->spool->isResumable()) {
+            qCDebug(lcWebCal) << feed->url << "keeping" << feed->spool->size()
+                              << "bytes to resume the download later.";
+            feed->spool->close();
+        } else {
+            feed->spool->remove();
+        }
+        feed->spool.reset();
+    }
+
+    syncFinished();
+}
+
+void WebCalClient::syncFinished()
+{
+    bool aborted = false;
+    for (const Feed *other : mFeeds) {
+        if (other->reply || other->state == Feed::Pending) {
+            return;
+        }
+        aborted = aborted || other->errorCode == Buteo::SyncResults::ABORTED;
+    }
+    if (aborted || isCancelled()) {
+        // Already reported by abortSync().
+        return;
+    }
+    startImport();
+    emit syncProgressDetail(iProfile.name(), Sync::SYNC_PROGRESS_FINALISING);
+}
+
+void WebCalClient::startImport()
+{
+    // Finishing to parse the feeds and saving the changes may take
+    // seconds, so it is done in a worker thread: the plugin thread
+    // stays responsive to abortSync() meanwhile. mKCal storage has
+    // helpers that do not follow a moveToThread(), so the worker opens
+    // its own storage, see commit(), and closes it once done. The one
+    // of the plugin thread is closed before.
+    if (mStorage) {
+        mStorage->close();
+        mCalendar->close();
+        mStorage.clear();
+        mCalendar.clear();
+    }
+    QThread *worker = new TaskThread([this] {
+            import();
+            if (mStorage) {
+                mStorage->close();
+                mCalendar->close();
+            }
+            mStorage.clear();
+            mCalendar.clear();
+        });
+    connect(worker, &QThread::finished, this, [this] {
+            importFinished();
+        });
+    mImportThread = worker;
+    worker->start();
+}
+
+void WebCalClient::import()
+{
+    for (Feed *feed : mFeeds) {
+        if (feed->state == Feed::Received) {
+            processData(feed, QByteArray(), feed->responseEtag, feed->responseLastModified);
+        }
+    }
+    if (isCancelled()) {
+        failed(Buteo::SyncResults::ABORTED, QStringLiteral("Synchronization aborted."));
+        return;
+    }
+    commit();
+}
+
+void WebCalClient::importFinished()
+{
+    if (!mImportThread) {
+        // Stopped by stopImport().
+        return;
+    }
+    mImportThread->wait();
+    delete mImportThread;
+    mImportThread = nullptr;
+
+    bool retry = false;
+    for (const Feed *feed : mFeeds) {
+        retry = retry || feed->state == Feed::Pending;
+    }
+    if (retry && isCancelled()) {
+        failed(Buteo::SyncResults::ABORTED, QStringLiteral("Synchronization aborted."));
+        return;
+    } else if (retry) {
+        for (Feed *feed : mFeeds) {
+            if (feed->state == Feed::Pending) {
+                // See updateIncidences(), the other feeds are committed.
+                qCDebug(lcWebCal) << "Requesting" << feed->url << "again.";
+                feed->hasContent = false;
+                feed->decoder.reset();
+                feed->transferredBytes = 0;
+                feed->contentBytes = 0;
+                requestFeed(feed, QByteArray(), QByteArray());
+            }
+        }
+        return;
+    }
+    report(mResultMessage);
+}
+
+void WebCalClient::stopImport()
+{
+    if (mImportThread) {
+        mCancelled.storeRelease(1);
+        mImportThread->wait();
+        delete mImportThread;
+        mImportThread = nullptr;
+    }
+}
+
+bool WebCalClient::isCancelled() const
+{
+    return mCancelled.loadAcquire();
+}
+
+static qint64 contentRangeStart(const QByteArray &contentRange)
+{
+    // Content-Range: bytes <start>-<end>/<size>
+    const QByteArray range = contentRange.trimmed();
+    if (!range.startsWith("bytes ")) {
+        return -1;
+    }
+    bool ok = false;
+    const qint64 start = range.mid(6, range.indexOf('-') - 6).trimmed().toLongLong(&ok);
+    return ok ? start : -1;
+}
+
+bool WebCalClient::startResponse(Feed *feed, QNetworkReply *reply)
+{
+    if (!feed->spool) {
+        feed->spool.reset(new DownloadSpool(feed->notebookUid));
+    }
+
+    if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 206) {
+        // The server accepted the Range request, replay what was
+        // received previously before the new data.
+        if (contentRangeStart(reply->rawHeader("Content-Range")) != feed->spool->size()
+            || !feed->spool->resume()) {
+            processError(feed, Buteo::SyncResults::CONNECTION_ERROR,
+                         QStringLiteral("Cannot resume download."));
+            return false;
+        }
+        qCDebug(lcWebCal) << feed->url << "resuming download after" << feed->spool->size() << "bytes.";
+        feed->decoder.reset(new ContentDecoder(feed->spool->contentEncoding()));
+        for (QByteArray data = feed->spool->replay(); !data.isEmpty(); data = feed->spool->replay()) {
+            if (!decodeData(feed, data)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Full content, any previous partial download is obsolete.
+    feed->decoder.reset(new ContentDecoder(reply->rawHeader("Content-Encoding")));
+    QByteArray validator = reply->rawHeader("etag");
+    if (validator.isEmpty() || validator.startsWith("W/")) {
+        // Weak validators cannot be used with If-Range.
+        validator = reply->rawHeader("Last-Modified");
+    }
+    const QVariant length = reply->header(QNetworkRequest::ContentLengthHeader);
+    if (length.isValid() && mBudget.maxBytes() > 0 && length.toLongLong() > mBudget.maxBytes()) {
+        // Encoded content is not smaller than the decoded one either.
+        budgetExceeded(feed, FeedBudget::Bytes);
+        return false;
+    }
+    if (!validator.isEmpty()
+        && reply->rawHeader("Accept-Ranges").trimmed() == "bytes"
+        && (!length.isValid() || length.toLongLong() >= SPOOL_THRESHOLD)) {
+        feed->spool->start(validator, reply->rawHeader("Content-Encoding"));
+    } else {
+        feed->spool->remove();
+    }
+    return true;
+}
+
+bool WebCalClient::receiveData(Feed *feed, QNetworkReply *reply)
+{
+    if (!feed->decoder && !startResponse(feed, reply)) {
+        return false;
+    }
+    // Data are read in place into the same buffer for the whole
+    // response, instead of allocating a new array on each chunk.
+    if (feed->buffer.capacity() < READ_BUFFER_SIZE) {
+        feed->buffer.reserve(READ_BUFFER_SIZE);
+    }
+    feed->buffer.resize(READ_BUFFER_SIZE);
+    qint64 size;
+    while ((size = reply->read(feed->buffer.data(), READ_BUFFER_SIZE)) > 0) {
+        feed->buffer.resize(size);
+        // Only what the network brings, not what a resumed download replays.
+        feed->transferredBytes += size;
+        // Spool failures are not fatal, the download is just not resumable.
+        feed->spool->append(feed->buffer);
+        if (!decodeData(feed, feed->buffer)) {
+            return false;
+        }
+        feed->buffer.resize(READ_BUFFER_SIZE);
+    }
+    feed->buffer.resize(0);
+    return true;
+}
+
+bool WebCalClient::decodeData(Feed *feed, const QByteArray &data)
+{
+    if (!feed->decoder->isValid()) {
+        processError(feed, Buteo::SyncResults::CONNECTION_ERROR,
+                     QStringLiteral("Unsupported content encoding."));
+        return false;
+    }
+    if (feed->decoder->isIdentity()) {
+        // Nothing to decode, data go to the parser as they are.
+        feed->contentBytes += data.size();
+        return readData(feed, data);
+    }
+    if (feed->decoded.capacity() < READ_BUFFER_SIZE) {
+        feed->decoded.reserve(READ_BUFFER_SIZE);
+    }
+    feed->decoded.resize(0);
+    // Decoding stops past the budget, so a small download
+    // does not inflate in memory before being rejected.
+    const qint64 limit = mBudget.maxBytes() > 0 ? mBudget.maxBytes() - feed->contentBytes : -1;
+    if (!feed->decoder->decode(data, &feed->decoded, limit)) {
+        processError(feed, Buteo::SyncResults::CONNECTION_ERROR,
+                     QStringLiteral("Cannot decode incoming data."));
+        return false;
+    }
+    feed->contentBytes = feed->decoder->decodedBytes();
+    return readData(feed, feed->decoded);
+}
+
+bool WebCalClient::readData(Feed *feed, const QByteArray &icsData)
+{
+    // Decoded content is counted by decodeData().
+    if (mBudget.maxBytes() > 0 && feed->contentBytes > mBudget.maxBytes()) {
+        budgetExceeded(feed, FeedBudget::Bytes);
+        return false;
+    }
+    // Components are parsed as soon as they are received,
+    // while the remaining of the data are still downloading.
+    if (!feed->parser) {
+        feed->parser.reset(new IcsStreamParser(mFilter, &mTimezoneCache));
+        feed->parser->setCancellation(&mCancelled);
+        feed->parser->setBudget(mBudget);
+        ComponentIndex known;
+        if (known.load(feed->notebookUid)) {
+            feed->parser->setKnownComponents(known);
+        }
+    }
+    QElapsedTimer timer;
+    timer.start();
+    const bool ok = feed->parser->append(icsData);
+    feed->parseNs += timer.nsecsElapsed();
+    if (!ok) {
+        parseFailed(feed);
+        return false;
+    }
+    return true;
+}
+
+void WebCalClient::parseFailed(Feed *feed)
+{
+    if (feed->parser && feed->parser->exceededLimit() != FeedBudget::None) {
+        feed->componentCount = feed->parser->componentCount();
+        budgetExceeded(feed, feed->parser->exceededLimit());
+    } else if (isCancelled()) {
+        processError(feed, Buteo::SyncResults::ABORTED,
+                     QStringLiteral("Synchronization aborted."));
+    } else {
+        processError(feed, Buteo::SyncResults::DATABASE_FAILURE,
+                     QStringLiteral("Cannot parse incoming ICS data."));
+    }
+}
+
+void WebCalClient::budgetExceeded(Feed *feed, FeedBudget::Limit limit)
+{
+    feed->exceeded = limit;
+    // Only the size limits protect memory, the others the time
+    // spent on the feed.
+    Buteo::SyncResults::MinorCode code = Buteo::SyncResults::LOW_MEMORY;
+    QString message;
+    switch (limit) {
+    case FeedBudget::Bytes:
+        message = QStringLiteral("Feed content is larger than %1 bytes.");
+        break;
+    case FeedBudget::Incidences:
+        message = QStringLiteral("Feed has more than %1 components.");
+        break;
+    case FeedBudget::RecurrenceDates:
+        code = Buteo::SyncResults::INTERNAL_ERROR;
+        message = QStringLiteral("Feed has a component with more than %1 recurrence dates.");
+        break;
+    case FeedBudget::ParseTime:
+        code = Buteo::SyncResults::INTERNAL_ERROR;
+        message = QStringLiteral("Feed takes more than %1 seconds to parse.");
+        break;
+    case FeedBudget::None:
+        break;
+    }
+    processError(feed, code, message.arg(mBudget.value(limit)));
+}
+
+void WebCalClient::processError(Feed *feed, Buteo::SyncResults::MinorCode code,
+                                const QString &message)
+{
+    qCWarning(lcWebCal) << feed->url << message;
+    feed->decoder.reset();
+    feed->parser.reset();
+    feed->state = Feed::Failed;
+    feed->errorCode = code;
+    feed->errorMessage = message;
+}
+
+void WebCalClient::processNotModified(Feed *feed)
+{
+    qCDebug(lcWebCal) << feed->url << "not modified, checked in" << mElapsed.elapsed() << "ms.";
+    feed->decoder.reset();
+    feed->parser.reset();
+    feed->state = Feed::NotModified;
+}
+
+void WebCalClient::processDonor(Feed *feed)
+{
+    if (feed->donorDigest == feed->digest) {
+        processNotModified(feed);
+        return;
+    }
+    qCDebug(lcWebCal) << feed->url << "reusing the content of" << feed->donorUid;
+    feed->decoder.reset();
+    feed->parser.reset();
+    feed->responseEtag = feed->donorEtag;
+    feed->responseLastModified = feed->donorLastModified;
+    feed->responseDigest = feed->donorDigest;
+    feed->finalUrl = feed->donorFinalUrl;
+    feed->calendarName = feed->donorCalendarName;
+    feed->calendarDescription = feed->donorDescription;
+    feed->hasContent = true;
+    feed->state = Feed::Modified;
+}
+
+bool WebCalClient::loadDonorIncidences(Feed *feed, KCalendarCore::Incidence::List *incidences)
+{
+    // The same UIDs are in both notebooks, so copies are taken
+    // before loading the notebook of the feed.
+    if (!mStorage->loadNotebookIncidences(feed->donorUid)) {
+        mCalendar->close();
+        return false;
+    }
+    for (const KCalendarCore::Incidence::Ptr &incidence : mCalendar->incidences(feed->donorUid)) {
+        incidences->append(KCalendarCore::Incidence::Ptr(incidence->clone()));
+    }
+    feed->parsed = incidences->count();
+    mCalendar->close();
+    return true;
+}
+
+void WebCalClient::processData(Feed *feed, const QByteArray &icsData, const QByteArray &etag,
+                               const QByteArray &lastModified)
+{
+    qCDebug(lcWebCal) << "Got etag" << etag << "was" << feed->etag;
+    if (!etag.isEmpty() && etag == feed->etag) {
+        processNotModified(feed);
+        return;
+    }
+
+    // Incoming ICS data are fully parsed before touching the
+    // stored ones, so a broken feed leaves the notebook as it was.
+    if (!readData(feed, icsData)) {
+        return;
+    }
+    if (feed->decoder && !feed->decoder->finish()) {
+        processError(feed, Buteo::SyncResults::CONNECTION_ERROR,
+                     QStringLiteral("Incomplete encoded data."));
         return;
     }
+    QElapsedTimer timer;
+    timer.start();
+    const bool ok = feed->parser->finish();
+    feed->parseNs += timer.nsecsElapsed();
+    if (!ok) {
+        parseFailed(feed);
+        return;
+    }
+    feed->parsed = feed->parser->incidences().count();
+    feed->filtered = feed->parser->filteredCount();
+    feed->skipped = feed->parser->skippedFingerprints().count();
+    feed->componentCount = feed->parser->componentCount();
+    qCDebug(lcWebCal) << feed->url << "received" << feed->transferredBytes
+                      << "bytes for" << feed->contentBytes << "bytes of ICS data.";
+    qCDebug(lcWebCal) << "From calendar" << feed->parser->calendarProperty("X-WR-CALNAME")
+                      << feed->parser->calendarProperty("X-WR-CALDESC");
+    qCDebug(lcWebCal) << "Filtered out" << feed->parser->filteredCount() << "incidences.";
+    feed->responseEtag = etag;
+    feed->responseLastModified = lastModified;
+    feed->responseDigest = feed->parser->digest();
+    feed->calendarName = feed->parser->calendarProperty("X-WR-CALNAME");
+    feed->calendarDescription = feed->parser->calendarProperty("X-WR-CALDESC");
+    feed->hasContent = true;
+    feed->state = Feed::Modified;
+    if (!feed->digest.isEmpty() && feed->parser->digest() == feed->digest) {
+        // Server does not provide validators, but the data are the same.
+        qCDebug(lcWebCal) << feed->url << "same content, checked in" << mElapsed.elapsed() << "ms.";
+        feed->state = Feed::NotModified;
+    }
+}
+
+static QString incidenceKey(const KCalendarCore::Incidence::Ptr &incidence)
+{
+    // Use the recurrence id in msecs since epoch, so stored and
+    // incoming exceptions match whatever time zone they are expressed in.
+    if (incidence->hasRecurrenceId()) {
+        return incidence->uid() + QLatin1Char('\n')
+            + QString::number(incidence->recurrenceId().toMSecsSinceEpoch());
+    }
+    return incidence->uid();
+}
+
+bool WebCalClient::updateIncidences(Feed *feed)
+{
+    // The parsed incidences are released with this list,
+    // only the changes are kept.
+    QSet<QString> incomingKeys;
+    KCalendarCore::Incidence::List incidences;
+    if (feed->parser) {
+        incidences = feed->parser->takeIncidences();
+    } else if (!loadDonorIncidences(feed, &incidences)) {
+        failed(Buteo::SyncResults::DATABASE_FAILURE,
+               QStringLiteral("Cannot load reused incidences."));
+        return false;
+    }
 
-    unsigned int added = 0, deleted = 0;
-    qCDebug(lcWebCal) << "Got etag" << etag << "was" << mNotebookEtag;
-    if (etag.isEmpty() || etag != mNotebookEtag) {
-        // Start by deleting all previous data.
-        if (!mStorage->loadNotebookIncidences(mNotebookUid)) {
+    if (!mStorage->loadNotebookIncidences(feed->notebookUid)) {
+        failed(Buteo::SyncResults::DATABASE_FAILURE,
+               QStringLiteral("Cannot load existing incidences."));
+        return false;
+    }
+
+    QHash<QString, KCalendarCore::Incidence::Ptr> stored;
+    for (const KCalendarCore::Incidence::Ptr &incidence : mCalendar->incidences(feed->notebookUid)) {
+        stored.insert(incidenceKey(incidence), incidence);
+    }
+
+    for (const KCalendarCore::Incidence::Ptr &incidence : incidences) {
+        const QString key = incidenceKey(incidence);
+        if (incomingKeys.contains(key)) {
+            qCWarning(lcWebCal) << "Ignoring duplicated incidence" << key;
+            continue;
+        }
+        incomingKeys.insert(key);
+
+        KCalendarCore::Incidence::Ptr local = stored.take(key);
+        if (local && local->type() != incidence->type()) {
+            // Cannot be updated in place, replace it.
+            feed->deletions.append(local);
+            feed->replaced += 1;
+            local.clear();
+        }
+        if (!local) {
+            feed->additions.append(KCalendarCore::Incidence::Ptr(incidence->clone()));
+        } else if (local->revision() != incidence->revision()
+                   || IcsStreamParser::fingerprint(local) != IcsStreamParser::fingerprint(incidence)) {
+            feed->updates.append(qMakePair(local, incidence));
+        } else {
+            feed->unchanged.append(local);
+        }
+    }
+
+    // Components skipped by the parser are stored as they are,
+    // unless the filter moved, like a rolling window.
+    QSet<QString> skipped = feed->parser ? feed->parser->skippedFingerprints() : QSet<QString>();
+    for (QHash<QString, KCalendarCore::Incidence::Ptr>::Iterator it = stored.begin(); it != stored.end() && !skipped.isEmpty();) {
+        if (skipped.remove(IcsStreamParser::fingerprint(it.value()))
+            && mFilter.acceptsType("V" + it.value()->typeStr().toUpper())
+            && mFilter.accepts(it.value())) {
+            feed->unchanged.append(it.value());
+            it = stored.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if (!skipped.isEmpty()) {
+        // The index does not match the storage anymore, like when
+        // something else modified the notebook. The feed is requested
+        // again without validators and parsed without the index, the
+        // validators are cleared in case this request fails.
+        qCWarning(lcWebCal) << skipped.count() << "skipped components are not stored in"
+                            << feed->notebookUid;
+        ComponentIndex::remove(feed->notebookUid);
+        mKCal::Notebook::Ptr notebook = mStorage->notebook(feed->notebookUid);
+        if (notebook) {
+            notebook->setCustomProperty(ETAG_PROPERTY, QString());
+            notebook->setCustomProperty(LAST_MODIFIED_PROPERTY, QString());
+            notebook->setCustomProperty(DIGEST_PROPERTY, QString());
+            mStorage->updateNotebook(notebook);
+        }
+        feed->etag.clear();
+        feed->lastModified.clear();
+        feed->digest.clear();
+        feed->additions.clear();
+        feed->updates.clear();
+        feed->deletions.clear();
+        feed->unchanged.clear();
+        mCalendar->close();
+        if (feed->retried) {
+            // Nothing was skipped this time, should not happen.
             failed(Buteo::SyncResults::DATABASE_FAILURE,
-                   QStringLiteral("Cannot load existing incidences."));
+                   QStringLiteral("Stored incidences do not match the component index."));
+            return false;
+        }
+        feed->parser.reset();
+        feed->retried = true;
+        feed->state = Feed::Pending;
+        return true;
+    }
+
+    // Remaining stored incidences are not in the feed anymore,
+    // delete exceptions before their parent.
+    for (const KCalendarCore::Incidence::Ptr &local : stored) {
+        if (local->hasRecurrenceId()) {
+            feed->deletions.append(local);
+        }
+    }
+    for (const KCalendarCore::Incidence::Ptr &local : stored) {
+        if (!local->hasRecurrenceId()) {
+            feed->deletions.append(local);
+        }
+    }
+    indexOccurrences(feed);
+    indexComponents(feed);
+    feed->added = feed->additions.count();
+    feed->modified = feed->updates.count();
+    feed->deleted = feed->deletions.count();
+    qCDebug(lcWebCal) << "Adding" << feed->added << "updating" << feed->modified
+                      << "deleting" << feed->deleted << "incidences in" << feed->notebookUid;
+
+    return true;
+}
+
+void WebCalClient::indexComponents(Feed *feed)
+{
+    if (!feed->parser) {
+        // Reused from another notebook, raw components are unknown.
+        return;
+    }
+    // Only index the components stored in the notebook,
+    // not the ones rejected by the filter.
+    QSet<QString> fingerprints;
+    for (const KCalendarCore::Incidence::Ptr &incidence : feed->additions) {
+        fingerprints.insert(IcsStreamParser::fingerprint(incidence));
+    }
+    for (const QPair<KCalendarCore::Incidence::Ptr, KCalendarCore::Incidence::Ptr> &update : feed->updates) {
+        fingerprints.insert(IcsStreamParser::fingerprint(update.second));
+    }
+    for (const KCalendarCore::Incidence::Ptr &local : feed->unchanged) {
+        fingerprints.insert(IcsStreamParser::fingerprint(local));
+    }
+    feed->components.reset(new ComponentIndex);
+    const QHash<QByteArray, QByteArray> components = feed->parser->components().fingerprints();
+    for (QHash<QByteArray, QByteArray>::ConstIterator it = components.constBegin();
+         it != components.constEnd(); ++it) {
+        if (fingerprints.contains(QString::fromLatin1(it.value()))) {
+            feed->components->insert(it.key(), it.value());
+        }
+    }
+}
+
+static QDateTime occurrenceWindowStart()
+{
+    return QDateTime(QDateTime::currentDateTimeUtc().date(), QTime(0, 0), Qt::UTC);
+}
+
+void WebCalClient::indexOccurrences(Feed *feed)
+{
+    if (mOccurrenceDays <= 0) {
+        return;
+    }
+    // Only expand the incidences that changed, or all of them
+    // when the window moved.
+    const QDateTime start = occurrenceWindowStart();
+    feed->index.reset(new OccurrenceIndex);
+    feed->index->load(feed->notebookUid);
+    feed->index->setWindow(start, start.addDays(mOccurrenceDays));
+    for (const KCalendarCore::Incidence::Ptr &local : feed->deletions) {
+        feed->index->remove(local);
+    }
+    for (const QPair<KCalendarCore::Incidence::Ptr, KCalendarCore::Incidence::Ptr> &update : feed->updates) {
+        feed->index->insert(update.second);
+    }
+    for (const KCalendarCore::Incidence::Ptr &incidence : feed->additions) {
+        feed->index->insert(incidence);
+    }
+    for (const KCalendarCore::Incidence::Ptr &local : feed->unchanged) {
+        if (!feed->index->contains(local)) {
+            feed->index->insert(local);
+        }
+    }
+}
+
+bool WebCalClient::occurrencesCurrent(const Feed *feed) const
+{
+    const QDateTime start = occurrenceWindowStart();
+    OccurrenceIndex index;
+    return index.load(feed->notebookUid) && index.windowStart() == start
+        && index.windowEnd() == start.addDays(mOccurrenceDays);
+}
+
+bool WebCalClient::refreshOccurrences(Feed *feed)
+{
+    if (occurrencesCurrent(feed)) {
+        return true;
+    }
+    const QDateTime start = occurrenceWindowStart();
+    feed->index.reset(new OccurrenceIndex);
+    if (!mStorage->loadNotebookIncidences(feed->notebookUid)) {
+        failed(Buteo::SyncResults::DATABASE_FAILURE,
+               QStringLiteral("Cannot load existing incidences."));
+        return false;
+    }
+    feed->index->setWindow(start, start.addDays(mOccurrenceDays));
+    for (const KCalendarCore::Incidence::Ptr &incidence : mCalendar->incidences(feed->notebookUid)) {
+        if (!feed->index->contains(incidence)) {
+            feed->index->insert(incidence);
+        }
+    }
+    mCalendar->close();
+    return true;
+}
+
+bool WebCalClient::writeChanges(Feed *feed)
+{
+    // Changes are saved at once, so an interrupted sync leaves
+    // the notebook as it was or fully updated.
+    for (const KCalendarCore::Incidence::Ptr &local : feed->deletions) {
+        mCalendar->deleteIncidence(local);
+    }
+    for (const QPair<KCalendarCore::Incidence::Ptr, KCalendarCore::Incidence::Ptr> &update : feed->updates) {
+        *update.first.staticCast<KCalendarCore::IncidenceBase>() =
+            *update.second.staticCast<KCalendarCore::IncidenceBase>();
+    }
+    if (!feed->additions.isEmpty()) {
+        mCalendar->addNotebook(feed->notebookUid, true);
+        mCalendar->setDefaultNotebook(feed->notebookUid);
+    }
+    for (const KCalendarCore::Incidence::Ptr &incidence : feed->additions) {
+        mCalendar->addIncidence(incidence);
+    }
+    const bool ok = !isCancelled() && mStorage->save(mKCal::ExtendedStorage::PurgeDeleted);
+    feed->deletions.clear();
+    feed->updates.clear();
+    feed->additions.clear();
+    // Saved incidences are not needed anymore.
+    mCalendar->close();
+    emit syncProgressDetail(iProfile.name(), Sync::SYNC_PROGRESS_FINALISING);
+
+    return ok;
+}
+
+bool WebCalClient::stageChanges(Feed *feed, int batchSize)
+{
+    mKCal::Notebook::Ptr current = mStorage->notebook(feed->notebookUid);
+    if (!current) {
+        return false;
+    }
+
+    // The whole content goes to a hidden notebook, promoted by
+    // commitNotebook(), so the visible one is never half written.
+    mKCal::Notebook::Ptr staging(new mKCal::Notebook(current->name(), current->description(),
+                                                     current->color()));
+    for (const QByteArray &key : current->customPropertyKeys()) {
+        staging->setCustomProperty(key, current->customProperty(key));
+    }
+    staging->setPluginName(current->pluginName());
+    staging->setSyncProfile(current->syncProfile());
+    staging->setAccount(current->account());
+    staging->setIsReadOnly(true);
+    staging->setIsVisible(false);
+    staging->setCustomProperty(STAGING_PROPERTY, feed->notebookUid);
+    if (!mStorage->addNotebook(staging)) {
+        qCWarning(lcWebCal) << "Cannot create a staging notebook for" << feed->notebookUid;
+        return false;
+    }
+    qCDebug(lcWebCal) << "Importing" << feed->notebookUid << "into" << staging->uid();
+
+    KCalendarCore::Incidence::List content;
+    for (const KCalendarCore::Incidence::Ptr &local : feed->unchanged) {
+        content.append(KCalendarCore::Incidence::Ptr(local->clone()));
+    }
+    for (const QPair<KCalendarCore::Incidence::Ptr, KCalendarCore::Incidence::Ptr> &update : feed->updates) {
+        content.append(KCalendarCore::Incidence::Ptr(update.second->clone()));
+    }
+    content += feed->additions;
+    feed->unchanged.clear();
+    feed->updates.clear();
+    feed->deletions.clear();
+    feed->additions.clear();
+    mCalendar->close();
+
+    int pending = 0;
+    for (int i = 0; i < content.count(); i++) {
+        if (!pending) {
+            mCalendar->addNotebook(staging->uid(), false);
+            mCalendar->setDefaultNotebook(staging->uid());
+        }
+        mCalendar->addIncidence(content[i]);
+        content[i].clear();
+        if (++pending >= batchSize || i == content.count() - 1) {
+            pending = 0;
+            if (isCancelled() || !mStorage->save()) {
+                mCalendar->close();
+                mStorage->deleteNotebook(staging);
+                return false;
+            }
+            mCalendar->close();
+            emit syncProgressDetail(iProfile.name(), Sync::SYNC_PROGRESS_FINALISING);
+        }
+    }
+
+    feed->replacedNotebookUid = feed->notebookUid;
+    feed->notebookUid = staging->uid();
+    return true;
+}
+
+void WebCalClient::commit()
+{
+    // Changes are saved by batches, feed after feed, so memory does not
+    // grow with the size of the feeds. Validators of a feed are only
+    // stored once all its changes are saved: an interrupted import is
+    // done again by the next sync and converges to the feed content.
+    // There is no transaction across notebooks, each one is consistent
+    // on its own, and an interrupted sync keeps the feeds committed
+    // before.
+    bool ok = false;
+    int batchSize = mClient ? mClient->key(QStringLiteral("commitBatchSize")).toInt(&ok) : 0;
+    if (!ok || batchSize <= 0) {
+        batchSize = DEFAULT_COMMIT_BATCH_SIZE;
+    }
+
+    mSaveNs = 0;
+    // When no feed changed, the notebooks are left as they are:
+    // the outcome is kept by the record until their next update.
+    bool unchanged = mRecorded && !mStorage;
+    for (const Feed *feed : mFeeds) {
+        unchanged = unchanged && feed->state == Feed::NotModified && !feed->hasContent
+            && (mOccurrenceDays <= 0 || occurrencesCurrent(feed));
+    }
+    if (unchanged) {
+        for (Feed *feed : mFeeds) {
+            recordOutcome(feed, ChangeHistory::Unchanged);
+            qCDebug(lcWebCal) << feed->url << "unchanged" << feed->unchangedSyncs << "times in a row.";
+        }
+        mTimezoneCache.save();
+        saveRecord();
+        succeed();
+        return;
+    }
+
+    if (!mStorage && !openStorage()) {
+        failed(Buteo::SyncResults::DATABASE_FAILURE,
+               QStringLiteral("Cannot open default storage."));
+        return;
+    }
+    for (const Feed *feed : mFeeds) {
+        if (feed->state == Feed::Modified) {
+            // Only valid again once all the changes are saved,
+            // and staging notebooks may be left until then.
+            FeedRecord::markImporting(getProfileName());
+            break;
+        }
+    }
+
+    for (Feed *feed : mFeeds) {
+        if (isCancelled()) {
+            failed(Buteo::SyncResults::ABORTED, QStringLiteral("Synchronization aborted."));
             return;
         }
-        deleted = mCalendar->incidences().count();
-        qCDebug(lcWebCal) << "Deleting" << deleted << "previous incidences.";
-        mCalendar->deleteAllIncidences();
-        // Deletion happens after insertion in mkcal, so ensure
-        // that incidences with a UID in icsData are deleted before.
-        if (deleted && !mStorage->save(mKCal::ExtendedStorage::PurgeDeleted)) {
-            failed(Buteo::SyncResults::DATABASE_FAILURE,
-                   QStringLiteral("Cannot delete previous data."));
+        if (feed->committed) {
+            // Before another feed was requested again.
+            continue;
+        }
+        feed->additions.clear();
+        feed->updates.clear();
+        feed->deletions.clear();
+        feed->unchanged.clear();
+        feed->replacedNotebookUid.clear();
+        feed->recommendedInterval = 0;
+        feed->added = feed->modified = feed->deleted = feed->replaced = 0;
+        if (feed->state == Feed::Failed) {
+            recordFailure(feed);
+            feed->committed = true;
+            continue;
+        }
+        if (feed->state == Feed::Modified) {
+            QElapsedTimer timer;
+            timer.start();
+            const bool diffed = updateIncidences(feed);
+            feed->diffNs = timer.nsecsElapsed();
+            if (!diffed) {
+                return;
+            } else if (feed->state == Feed::Pending) {
+                // Committed once received again.
+                continue;
+            }
+        } else if (mOccurrenceDays > 0 && !refreshOccurrences(feed)) {
             return;
         }
 
-        // Recreate all incidences from incoming ICS data.
-        mCalendar->addNotebook(mNotebookUid, true);
-        mCalendar->setDefaultNotebook(mNotebookUid);
-        KCalendarCore::ICalFormat iCalFormat;
-        qCDebug(lcWebCal) << icsData;
-        if (!icsData.isEmpty() && !iCalFormat.fromRawString(mCalendar, icsData)) {
-            failed(Buteo::SyncResults::DATABASE_FAILURE,
-                   QStringLiteral("Cannot parse incoming ICS data."));
+        // The index of stored components is only valid
+        // once all the changes are saved.
+        if (feed->state == Feed::Modified) {
+            ComponentIndex::remove(feed->notebookUid);
+        }
+
+        // Changes fitting in one batch are saved in place by a single
+        // save, larger imports are staged. So are replaced incidences:
+        // mKCal inserts before deleting, their deletion cannot be saved
+        // together with their replacement.
+        const bool staged = feed->replaced
+            || feed->added + feed->modified + feed->deleted > unsigned(batchSize);
+        QElapsedTimer saveTimer;
+        saveTimer.start();
+        if (!(staged ? stageChanges(feed, batchSize) : writeChanges(feed))) {
+            mSaveNs += saveTimer.nsecsElapsed();
+            // Drop what was not saved.
+            mCalendar->close();
+            if (isCancelled()) {
+                failed(Buteo::SyncResults::ABORTED, QStringLiteral("Synchronization aborted."));
+            } else {
+                failed(Buteo::SyncResults::DATABASE_FAILURE,
+                       QStringLiteral("Cannot store data."));
+            }
             return;
         }
-        added = mCalendar->incidences().count();
-        qCDebug(lcWebCal) << "Adding" << added << "new incidences.";
-        qCDebug(lcWebCal) << "From calendar" << mCalendar->nonKDECustomProperty("X-WR-CALNAME")
-                  << mCalendar->nonKDECustomProperty("X-WR-CALDESC");
-        if (added && !mStorage->save()) {
-            failed(Buteo::SyncResults::DATABASE_FAILURE,
-                   QStringLiteral("Cannot store data."));
+        const bool committed = commitNotebook(feed);
+        mSaveNs += saveTimer.nsecsElapsed();
+        if (!committed) {
             return;
         }
+        feed->committed = true;
+        feed->parser.reset();
+    }
+    const Feed *failure = nullptr;
+    for (const Feed *feed : mFeeds) {
+        if (feed->state == Feed::Pending) {
+            // Reported once all the feeds are committed.
+            return;
+        }
+        if (!failure && feed->state == Feed::Failed) {
+            failure = feed;
+        }
+    }
+    for (Feed *feed : mFeeds) {
+        feed->committed = false;
+    }
+    mTimezoneCache.save();
+    saveRecord();
+    if (failure) {
+        failed(failure->errorCode, failure->errorMessage);
+    } else {
+        succeed();
+    }
+}
 
-        // Record the etag so we only update in future if necessary.
-        notebook->setCustomProperty(ETAG_PROPERTY, etag);
+bool WebCalClient::commitNotebook(Feed *feed)
+{
+    mKCal::Notebook::Ptr notebook = mStorage->notebook(feed->notebookUid);
+    if (!notebook) {
+        // Deleted behind the record, look for it again next time.
+        FeedRecord::remove(getProfileName());
+        failed(Buteo::SyncResults::DATABASE_FAILURE,
+               QStringLiteral("Cannot find notebook."));
+        return false;
+    }
+
+    recordOutcome(feed, feed->state == Feed::NotModified ? ChangeHistory::Unchanged : ChangeHistory::Changed);
+    if (feed->state == Feed::NotModified) {
+        qCDebug(lcWebCal) << feed->url << "unchanged" << feed->unchangedSyncs << "times in a row.";
+    }
+    notebook->setCustomProperty(UNCHANGED_PROPERTY, feed->unchangedSyncs
+                                ? QString::number(feed->unchangedSyncs) : QString());
+    notebook->setCustomProperty(HISTORY_PROPERTY, feed->history);
+    notebook->setCustomProperty(SYNC_INTERVAL_PROPERTY, QString::number(feed->recommendedInterval));
+    if (feed->hasContent) {
+        // Record the validators so we only update in future if necessary.
+        notebook->setCustomProperty(ETAG_PROPERTY, feed->responseEtag);
+        notebook->setCustomProperty(LAST_MODIFIED_PROPERTY, QString::fromUtf8(feed->responseLastModified));
+        notebook->setCustomProperty(DIGEST_PROPERTY, QString::fromLatin1(feed->responseDigest));
+        notebook->setCustomProperty(FINAL_URL_PROPERTY, feed->finalUrl);
+        notebook->setCustomProperty(CALENDAR_NAME_PROPERTY, feed->calendarName);
+        // And which incidences are missing from the notebook.
+        notebook->setCustomProperty(WINDOW_START_PROPERTY, mFilter.windowStart().toString(Qt::ISODate));
+        notebook->setCustomProperty(WINDOW_END_PROPERTY, mFilter.windowEnd().toString(Qt::ISODate));
+        notebook->setCustomProperty(FILTER_PROPERTY, QString::fromLatin1(mFilter.signature()));
+        // Keep track of the bandwidth saved by compression.
+        notebook->setCustomProperty(TRANSFERRED_BYTES_PROPERTY, QString::number(feed->transferredBytes));
+        notebook->setCustomProperty(CONTENT_BYTES_PROPERTY, QString::number(feed->contentBytes));
         // Store calendar name, if auto-detect has been requested.
-        if (mClient->key("label").isEmpty()) {
-            notebook->setName(mCalendar->nonKDECustomProperty("X-WR-CALNAME"));
+        if (feed->label.isEmpty()) {
+            notebook->setName(feed->calendarName);
         }
-        if (!mCalendar->nonKDECustomProperty("X-WR-CALDESC").isEmpty()
-            && mCalendar->nonKDECustomProperty("X-WR-CALDESC") != notebook->name()) {
-            notebook->setDescription(mCalendar->nonKDECustomProperty("X-WR-CALDESC"));
+        if (!feed->calendarDescription.isEmpty()
+            && feed->calendarDescription != notebook->name()) {
+            notebook->setDescription(feed->calendarDescription);
         }
     }
     // Ensure that settings for the notebook are consistent.
-    if (!mClient->key("label").isEmpty()) {
-        notebook->setName(mClient->key("label"));
+    if (!feed->label.isEmpty()) {
+        notebook->setName(feed->label);
     }
     if (!iProfile.key("accountid").isEmpty()) {
         notebook->setAccount(iProfile.key("accountid"));
     }
+    notebook->setCustomProperty(URL_PROPERTY, feed->url);
     notebook->setIsReadOnly(true);
     notebook->setIsMaster(false);
-    notebook->setSyncDate(QDateTime::currentDateTimeUtc());
+    notebook->setSyncDate(feed->syncDate);
+    mKCal::Notebook::Ptr replaced;
+    if (!feed->replacedNotebookUid.isEmpty()) {
+        // Promote the staging notebook, in the same update as its metadata.
+        replaced = mStorage->notebook(feed->replacedNotebookUid);
+        notebook->setIsVisible(!replaced || replaced->isVisible());
+        notebook->setCustomProperty(STAGING_PROPERTY, QString());
+    }
+    if (replaced) {
+        // Hidden first, so both are never shown together. After an
+        // interruption, openStorage() deletes it if the staging
+        // notebook was promoted, or shows it again otherwise.
+        replaced->setIsVisible(false);
+        replaced->setCustomProperty(REPLACED_PROPERTY, notebook->uid());
+        if (!mStorage->updateNotebook(replaced)) {
+            failed(Buteo::SyncResults::DATABASE_FAILURE,
+                   QStringLiteral("Cannot hide replaced notebook."));
+            return false;
+        }
+    }
     if (!mStorage->updateNotebook(notebook)) {
         failed(Buteo::SyncResults::DATABASE_FAILURE,
                QStringLiteral("Cannot update notebook."));
-        return;
+        return false;
+    }
+    if (feed->index) {
+        feed->index->save(feed->notebookUid);
+        feed->index.reset();
+    } else if (mOccurrenceDays <= 0) {
+        OccurrenceIndex::remove(feed->notebookUid);
+    }
+    if (feed->components) {
+        feed->components->save(feed->notebookUid);
+        feed->components.reset();
+    }
+    if (replaced) {
+        // The record is still marked as importing,
+        // the deletion is tried again by the next sync.
+        if (!mStorage->deleteNotebook(replaced)) {
+            failed(Buteo::SyncResults::DATABASE_FAILURE,
+                   QStringLiteral("Cannot delete replaced notebook."));
+            return false;
+        }
+        OccurrenceIndex::remove(replaced->uid());
+        ComponentIndex::remove(replaced->uid());
+    }
+    feed->replacedNotebookUid.clear();
+    feed->name = notebook->name();
+    if (feed->hasContent) {
+        // The notebook is now in sync with these validators.
+        feed->etag = feed->responseEtag;
+        feed->lastModified = feed->responseLastModified;
+        feed->digest = feed->responseDigest;
+        feed->filterSignature = mFilter.signature();
+        feed->windowStart = mFilter.windowStart();
+        feed->windowEnd = mFilter.windowEnd();
     }
 
-    succeed(notebook->name(), added, deleted);
+    return true;
 }
 
+void WebCalClient::recordFailure(Feed *feed)
+{
+    // Failing feeds are retried less and less often.
+    mKCal::Notebook::Ptr notebook = mStorage->notebook(feed->notebookUid);
+    if (!notebook) {
+        return;
+    }
+    recordOutcome(feed, ChangeHistory::Failed);
+    // Unchanged syncs kept by the record are written at the same time.
+    notebook->setCustomProperty(UNCHANGED_PROPERTY, feed->unchangedSyncs
+                                ? QString::number(feed->unchangedSyncs) : QString());
+    notebook->setCustomProperty(HISTORY_PROPERTY, feed->history);
+    notebook->setCustomProperty(SYNC_INTERVAL_PROPERTY, QString::number(feed->recommendedInterval));
+    if (feed->syncDate.isValid()) {
+        notebook->setSyncDate(feed->syncDate);
+    }
+    if (!mStorage->updateNotebook(notebook)) {
+        qCWarning(lcWebCal) << "Cannot record failure in notebook" << feed->notebookUid;
+    }
+}
+
+void WebCalClient::recordOutcome(Feed *feed, ChangeHistory::Outcome outcome)
+{
+    ChangeHistory history(feed->history);
+    history.record(outcome);
+    feed->history = history.toString();
+    if (outcome == ChangeHistory::Failed) {
+        feed->recommendedInterval = history.recommendedInterval();
+        return;
+    }
+    feed->recommendedInterval = history.recommendedInterval(feed->cacheLifetime);
+    feed->unchangedSyncs = outcome == ChangeHistory::Unchanged ? feed->unchangedSyncs + 1 : 0;
+    feed->syncDate = QDateTime::currentDateTimeUtc();
+}
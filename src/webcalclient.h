@@ -30,8 +30,24 @@
 
 #include <extendedstorage.h>
 
+#include "incidencefilter.h"
+#include "icsstreamparser.h"
+#include "contentdecoder.h"
+#include "downloadspool.h"
+#include "occurrenceindex.h"
+#include "componentindex.h"
+#include "timezonecache.h"
+#include "feedbudget.h"
+#include "changehistory.h"
+
 #include <QObject>
+#include <QAtomicInt>
 #include <QLoggingCategory>
+#include <QScopedPointer>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QJsonObject>
+#include <QList>
 
 #if defined(BUTEOWEBCALPLUGIN_LIBRARY)
 #  define SHARED_EXPORT Q_DECL_EXPORT
@@ -39,7 +55,9 @@
 #  define SHARED_EXPORT Q_DECL_IMPORT
 #endif
 
+class QNetworkAccessManager;
 class QNetworkReply;
+class QThread;
 
 class SHARED_EXPORT WebCalClient : public Buteo::ClientPlugin
 {
@@ -61,24 +79,161 @@ public:
 public Q_SLOTS:
     virtual void connectivityStateChanged(Sync::ConnectivityType aType, bool aState);
 
-private Q_SLOTS:
-    void dataReceived();
-
 private:
-    void succeed(const QString &label, unsigned int added, unsigned int deleted);
+    // One remote calendar of the profile, stored in its own notebook.
+    struct Feed {
+        enum State {
+            Pending,
+            // Downloaded, to be parsed to the end by import().
+            Received,
+            NotModified,
+            Modified,
+            Failed
+        };
+
+        QString url;
+        QString label;
+        QString notebookUid;
+        QByteArray etag;
+        QByteArray lastModified;
+        QByteArray digest;
+        QString finalUrl;
+        // Filter and time window the notebook content was imported with.
+        QByteArray filterSignature;
+        QDateTime windowStart;
+        QDateTime windowEnd;
+        // Outcome of the last syncs, kept by the record
+        // until the notebook is updated again.
+        QString history;
+        int unchangedSyncs = 0;
+        QDateTime syncDate;
+
+        // Same feed synced by another profile.
+        QString donorUid;
+        QByteArray donorEtag;
+        QByteArray donorLastModified;
+        QByteArray donorDigest;
+        QString donorFinalUrl;
+        QString donorCalendarName;
+        QString donorDescription;
+        QDateTime donorSyncDate;
+        bool useDonor = false;
+
+        QNetworkReply *reply = nullptr;
+        QScopedPointer<DownloadSpool> spool;
+        QScopedPointer<ContentDecoder> decoder;
+        // Reused for every chunk of a response.
+        QByteArray buffer;
+        QByteArray decoded;
+        QScopedPointer<IcsStreamParser> parser;
+        State state = Pending;
+        QByteArray responseEtag;
+        QByteArray responseLastModified;
+        QByteArray responseDigest;
+        QString calendarName;
+        QString calendarDescription;
+        bool hasContent = false;
+        Buteo::SyncResults::MinorCode errorCode = Buteo::SyncResults::NO_ERROR;
+        QString errorMessage;
+        qint64 transferredBytes = 0;
+        qint64 contentBytes = 0;
+
+        QElapsedTimer requestTimer;
+        qint64 connectNs = 0;
+        qint64 downloadNs = 0;
+        qint64 parseNs = 0;
+        qint64 diffNs = 0;
+        int parsed = 0;
+        int filtered = 0;
+        int skipped = 0;
+        int componentCount = 0;
+        FeedBudget::Limit exceeded = FeedBudget::None;
+        // Requested again in the same sync, see updateIncidences().
+        bool retried = false;
+        // Saved by a previous pass of commit() in the same sync.
+        bool committed = false;
+        qint64 cacheLifetime = -1;
+        qint64 recommendedInterval = 0;
+
+        KCalendarCore::Incidence::List additions;
+        QList<QPair<KCalendarCore::Incidence::Ptr, KCalendarCore::Incidence::Ptr>> updates;
+        KCalendarCore::Incidence::List deletions;
+        KCalendarCore::Incidence::List unchanged;
+        QString replacedNotebookUid;
+        QScopedPointer<OccurrenceIndex> index;
+        QScopedPointer<ComponentIndex> components;
+        QString name;
+        unsigned int added = 0;
+        unsigned int modified = 0;
+        unsigned int deleted = 0;
+        // Deletions replaced by an incidence of another type.
+        unsigned int replaced = 0;
+    };
+
+    void succeed();
     void failed(Buteo::SyncResults::MinorCode code, const QString &message);
-    void processData(const QByteArray &icsData, const QByteArray &etag);
+    void report(const QString &message);
+    void recordStatistics();
+    void requestFeed(Feed *feed, const QByteArray &etag, const QByteArray &lastModified);
+    void dataReceived(Feed *feed);
+    void replyFinished(Feed *feed);
+    void syncFinished();
+    void startImport();
+    void import();
+    void importFinished();
+    void stopImport();
+    bool isCancelled() const;
+    bool openStorage();
+    bool loadRecord();
+    void saveRecord();
+    void findDonor(Feed *feed, const QList<mKCal::Notebook::Ptr> &notebooks);
+    void processDonor(Feed *feed);
+    bool loadDonorIncidences(Feed *feed, KCalendarCore::Incidence::List *incidences);
+    bool startResponse(Feed *feed, QNetworkReply *reply);
+    bool receiveData(Feed *feed, QNetworkReply *reply);
+    bool decodeData(Feed *feed, const QByteArray &data);
+    bool readData(Feed *feed, const QByteArray &icsData);
+    void parseFailed(Feed *feed);
+    void budgetExceeded(Feed *feed, FeedBudget::Limit limit);
+    void processData(Feed *feed, const QByteArray &icsData, const QByteArray &etag,
+                     const QByteArray &lastModified = QByteArray());
+    void processNotModified(Feed *feed);
+    void processError(Feed *feed, Buteo::SyncResults::MinorCode code, const QString &message);
+    void commit();
+    bool updateIncidences(Feed *feed);
+    void indexOccurrences(Feed *feed);
+    void indexComponents(Feed *feed);
+    bool occurrencesCurrent(const Feed *feed) const;
+    bool refreshOccurrences(Feed *feed);
+    bool writeChanges(Feed *feed);
+    bool stageChanges(Feed *feed, int batchSize);
+    bool commitNotebook(Feed *feed);
+    void recordFailure(Feed *feed);
+    void recordOutcome(Feed *feed, ChangeHistory::Outcome outcome);
 
     const Buteo::Profile        *mClient;
-    QString                      mNotebookUid;
-    QByteArray                   mNotebookEtag;
+    QList<Feed*>                 mFeeds;
+    IncidenceFilter              mFilter;
+    FeedBudget                   mBudget;
+    TimezoneCache                mTimezoneCache;
+    int                          mOccurrenceDays;
     mKCal::ExtendedCalendar::Ptr mCalendar;
     mKCal::ExtendedStorage::Ptr  mStorage;
+    // Feeds are known from the record, see loadRecord().
+    bool                         mRecorded;
 
-    QNetworkReply               *mReply;
+    QNetworkAccessManager       *mNetworkManager;
+    // Runs import() with its own storage, see startImport().
+    QThread                     *mImportThread;
+    QAtomicInt                   mCancelled;
+    QString                      mResultMessage;
+    QElapsedTimer                mElapsed;
     Buteo::SyncResults           mResults;
+    qint64                       mSaveNs;
+    QJsonObject                  mStatistics;
 
     friend class tst_WebCalClient;
+    friend class bench_WebCalClient;
 };
 
 class WebCalClientLoader : public Buteo::SyncPluginLoader
@@ -0,0 +1,252 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "feedserver.h"
+
+#include <QTcpSocket>
+#include <QPointer>
+#include <QTimer>
+
+#include <zlib.h>
+
+// Size of the pieces of a body when the link is not throttled.
+static const int WRITE_SIZE = 16384;
+
+struct FeedServer::Transfer {
+    QPointer<QTcpSocket> socket;
+    QByteArray body;
+    int offset;
+    bool chunked;
+    qint64 limit;
+};
+
+static QByteArray gzip(const QByteArray &data)
+{
+    z_stream stream = {};
+    // 16 + MAX_WBITS writes a gzip header and trailer.
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return QByteArray();
+    }
+    QByteArray output(int(deflateBound(&stream, uLong(data.size()))), '\0');
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.constData()));
+    stream.avail_in = uInt(data.size());
+    stream.next_out = reinterpret_cast<Bytef *>(output.data());
+    stream.avail_out = uInt(output.size());
+    const int ret = deflate(&stream, Z_FINISH);
+    output.resize(int(stream.total_out));
+    deflateEnd(&stream);
+    return ret == Z_STREAM_END ? output : QByteArray();
+}
+
+FeedServer::FeedServer(QObject *parent)
+    : QTcpServer(parent)
+    , mChunkSize(0)
+    , mDelay(0)
+{
+    connect(this, &QTcpServer::newConnection, this, &FeedServer::acceptConnection);
+}
+
+bool FeedServer::start()
+{
+    return listen(QHostAddress::LocalHost);
+}
+
+QString FeedServer::url(const QString &path) const
+{
+    return QStringLiteral("http://127.0.0.1:%1%2").arg(serverPort()).arg(path);
+}
+
+void FeedServer::setFeed(const QString &path, const QByteArray &content,
+                         const QByteArray &etag, const QByteArray &lastModified,
+                         Options options)
+{
+    mRedirects.remove(path);
+    mFeeds.insert(path, Feed{content, etag, lastModified, options});
+}
+
+void FeedServer::setRedirect(const QString &path, const QString &target)
+{
+    mFeeds.remove(path);
+    mRedirects.insert(path, target);
+}
+
+void FeedServer::setThrottle(int chunkSize, int delay)
+{
+    mChunkSize = chunkSize;
+    mDelay = delay;
+}
+
+void FeedServer::setDisconnectAfter(const QString &path, qint64 bytes)
+{
+    mDisconnects.insert(path, bytes);
+}
+
+int FeedServer::requestCount(const QString &path) const
+{
+    return mRequestCounts.value(path);
+}
+
+QByteArray FeedServer::lastHeader(const QString &path, const QByteArray &name) const
+{
+    return mLastHeaders.value(path).value(name);
+}
+
+void FeedServer::acceptConnection()
+{
+    while (QTcpSocket *socket = nextPendingConnection()) {
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+        connect(socket, &QIODevice::readyRead, this, [this, socket] {
+                // Requests are GET without body, complete
+                // once the empty line is received.
+                QByteArray request = socket->property("request").toByteArray();
+                request += socket->readAll();
+                const int end = request.indexOf("\r\n\r\n");
+                if (end < 0) {
+                    socket->setProperty("request", request);
+                    return;
+                }
+                disconnect(socket, &QIODevice::readyRead, this, nullptr);
+                respond(socket, request.left(end));
+            });
+    }
+}
+
+void FeedServer::respond(QTcpSocket *socket, const QByteArray &request)
+{
+    const QList<QByteArray> lines = request.split('\n');
+    const QList<QByteArray> requestLine = lines.first().trimmed().split(' ');
+    const QString path = requestLine.size() > 1 ? QString::fromLatin1(requestLine[1]) : QString();
+    QHash<QByteArray, QByteArray> headers;
+    for (int i = 1; i < lines.size(); i++) {
+        const int colon = lines[i].indexOf(':');
+        if (colon > 0) {
+            headers.insert(lines[i].left(colon).trimmed().toLower(),
+                           lines[i].mid(colon + 1).trimmed());
+        }
+    }
+    mRequestCounts[path] += 1;
+    mLastHeaders.insert(path, headers);
+
+    QByteArray response;
+    QByteArray body;
+    bool chunked = false;
+    qint64 limit = -1;
+    if (mRedirects.contains(path)) {
+        response = "HTTP/1.1 302 Found\r\nLocation: "
+            + url(mRedirects.value(path)).toLatin1() + "\r\nContent-Length: 0\r\n";
+    } else if (!mFeeds.contains(path)) {
+        response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n";
+    } else {
+        const Feed &feed = mFeeds[path];
+        QByteArray validators;
+        if (!feed.etag.isEmpty()) {
+            validators += "ETag: " + feed.etag + "\r\n";
+        }
+        if (!feed.lastModified.isEmpty()) {
+            validators += "Last-Modified: " + feed.lastModified + "\r\n";
+        }
+        const bool notModified = feed.etag.isEmpty()
+            ? (!feed.lastModified.isEmpty() && headers.value("if-modified-since") == feed.lastModified)
+            : headers.value("if-none-match") == feed.etag;
+        if (notModified) {
+            response = "HTTP/1.1 304 Not Modified\r\n" + validators;
+        } else {
+            QByteArray status("200 OK");
+            body = feed.content;
+            response = "Content-Type: text/calendar; charset=utf-8\r\n" + validators;
+            if (feed.options.testFlag(Gzip) && headers.value("accept-encoding").contains("gzip")) {
+                body = gzip(body);
+                response += "Content-Encoding: gzip\r\n";
+            }
+            if (feed.options.testFlag(Ranges)) {
+                response += "Accept-Ranges: bytes\r\n";
+                const QByteArray range = headers.value("range");
+                const QByteArray ifRange = headers.value("if-range");
+                const qint64 start = range.startsWith("bytes=") && range.endsWith('-')
+                    ? range.mid(6, range.size() - 7).toLongLong() : -1;
+                if (start > 0 && start < body.size() && !ifRange.isEmpty()
+                    && (ifRange == feed.etag || ifRange == feed.lastModified)) {
+                    status = "206 Partial Content";
+                    response += "Content-Range: bytes " + QByteArray::number(start) + '-'
+                        + QByteArray::number(body.size() - 1) + '/'
+                        + QByteArray::number(body.size()) + "\r\n";
+                    body = body.mid(int(start));
+                }
+            }
+            chunked = feed.options.testFlag(Chunked);
+            if (chunked) {
+                response += "Transfer-Encoding: chunked\r\n";
+            } else {
+                response += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+            }
+            response.prepend("HTTP/1.1 " + status + "\r\n");
+            if (mDisconnects.contains(path)) {
+                limit = mDisconnects.take(path);
+            }
+        }
+    }
+    socket->write(response + "Connection: close\r\n\r\n");
+    sendBody(socket, body, chunked, limit);
+}
+
+void FeedServer::sendBody(QTcpSocket *socket, const QByteArray &body, bool chunked, qint64 limit)
+{
+    QSharedPointer<Transfer> transfer(new Transfer{socket, body, 0, chunked, limit});
+    writeNext(transfer);
+}
+
+void FeedServer::writeNext(const QSharedPointer<Transfer> &transfer)
+{
+    QTcpSocket *socket = transfer->socket;
+    if (!socket) {
+        return;
+    }
+    const int pieceSize = mChunkSize > 0 ? mChunkSize : WRITE_SIZE;
+    while (transfer->offset < transfer->body.size()) {
+        if (transfer->limit >= 0 && transfer->offset >= transfer->limit) {
+            // The link is lost in the middle of the body.
+            socket->disconnectFromHost();
+            return;
+        }
+        qint64 size = qMin(pieceSize, transfer->body.size() - transfer->offset);
+        if (transfer->limit >= 0) {
+            size = qMin(size, transfer->limit - transfer->offset);
+        }
+        const QByteArray piece = transfer->body.mid(transfer->offset, int(size));
+        if (transfer->chunked) {
+            socket->write(QByteArray::number(piece.size(), 16) + "\r\n" + piece + "\r\n");
+        } else {
+            socket->write(piece);
+        }
+        transfer->offset += int(size);
+        if (mChunkSize > 0 && mDelay > 0) {
+            QTimer::singleShot(mDelay, socket, [this, transfer] {
+                    writeNext(transfer);
+                });
+            return;
+        }
+    }
+    if (transfer->chunked) {
+        socket->write("0\r\n\r\n");
+    }
+    socket->disconnectFromHost();
+}
@@ -0,0 +1,121 @@
+/*
+ * This file is part of buteo-sync-plugin-webcal package
+ *
+ * Copyright (C) 2026 Jolla Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef FEEDSERVER_H
+#define FEEDSERVER_H
+
+#include <QTcpServer>
+#include <QHash>
+#include <QByteArray>
+#include <QString>
+#include <QSharedPointer>
+
+class QTcpSocket;
+
+/*! \brief Local HTTP server serving recorded feeds
+ *
+ * Used by tests and benchmarks to run complete synchronisations
+ * through QNetworkAccessManager without network access. Feeds are
+ * served on the loopback interface, with conditional requests,
+ * redirections, range requests, chunked transfer and gzip encoding,
+ * and the link can be throttled or cut during a transfer.
+ *
+ * Every connection is closed after its response.
+ */
+class FeedServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    enum Option {
+        NoOption = 0x0,
+        Chunked = 0x1, // Body sent with Transfer-Encoding: chunked
+        Gzip = 0x2,    // Body gzip encoded when the client accepts it
+        Ranges = 0x4   // Range requests with If-Range are honoured
+    };
+    Q_DECLARE_FLAGS(Options, Option)
+
+    explicit FeedServer(QObject *parent = nullptr);
+
+    /*! \brief Starts listening on a free port of the loopback interface */
+    bool start();
+
+    /*! \brief URL of the given path on this server */
+    QString url(const QString &path) const;
+
+    /*! \brief Serves content at path
+     *
+     * A request is answered with 304 when its If-None-Match header
+     * matches etag, or without etag, when its If-Modified-Since
+     * header matches lastModified.
+     */
+    void setFeed(const QString &path, const QByteArray &content,
+                 const QByteArray &etag = QByteArray(),
+                 const QByteArray &lastModified = QByteArray(),
+                 Options options = NoOption);
+
+    /*! \brief Redirects requests for path to target with a 302 */
+    void setRedirect(const QString &path, const QString &target);
+
+    /*! \brief Simulates a slow link
+     *
+     * Bodies are then sent by pieces of chunkSize bytes every
+     * delay milliseconds. A zero chunkSize removes the throttling.
+     */
+    void setThrottle(int chunkSize, int delay);
+
+    /*! \brief Closes the connection of the next request for path
+     *  after bytes bytes of its body were sent */
+    void setDisconnectAfter(const QString &path, qint64 bytes);
+
+    /*! \brief Number of requests received for path */
+    int requestCount(const QString &path) const;
+
+    /*! \brief Value of a header of the last request for path,
+     *  name being in lower case */
+    QByteArray lastHeader(const QString &path, const QByteArray &name) const;
+
+private:
+    struct Feed {
+        QByteArray content;
+        QByteArray etag;
+        QByteArray lastModified;
+        Options options;
+    };
+    struct Transfer;
+
+    void acceptConnection();
+    void respond(QTcpSocket *socket, const QByteArray &request);
+    void sendBody(QTcpSocket *socket, const QByteArray &body, bool chunked, qint64 limit);
+    void writeNext(const QSharedPointer<Transfer> &transfer);
+
+    QHash<QString, Feed> mFeeds;
+    QHash<QString, QString> mRedirects;
+    QHash<QString, qint64> mDisconnects;
+    QHash<QString, int> mRequestCounts;
+    QHash<QString, QHash<QByteArray, QByteArray>> mLastHeaders;
+    int mChunkSize;
+    int mDelay;
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(FeedServer::Options)
+
+#endif // FEEDSERVER_H
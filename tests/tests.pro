@@ -6,7 +6,10 @@ CONFIG += debug
 
 include($$PWD/../src/src.pri)
 
-SOURCES += tst_webcalclient.cpp
+SOURCES += tst_webcalclient.cpp \
+        feedserver.cpp
+
+HEADERS += feedserver.h
 
 target.path = /opt/tests/buteo/plugins/webcal/
 
@@ -23,6 +23,21 @@
 #include <QThread>
 
 #include <webcalclient.h>
+#include <icsstreamparser.h>
+#include <contentdecoder.h>
+#include <downloadspool.h>
+#include <synchistory.h>
+#include <changehistory.h>
+#include <occurrenceindex.h>
+#include <timezonecache.h>
+#include <componentindex.h>
+#include <stringpool.h>
+#include <feedbudget.h>
+#include <feedrecord.h>
+
+#include "feedserver.h"
+
+#include <zlib.h>
 
 class tst_WebCalClient : public QObject
 {
@@ -47,13 +62,44 @@ private slots:
     void downloadWithDifferentEtag();
     void downloadWithMetaDataUpdateOnly();
     void downloadWithoutEtag();
+    void downloadWithUnchangedContent();
+    void downloadInChunks();
+    void downloadTruncated();
+    void contentDecoding_data();
+    void contentDecoding();
+    void resumeDownload();
+    void downloadWithSameDigest();
+    void downloadNotModified();
+    void parseWithFilter();
+    void parseWithProjection();
+    void stringPool();
+    void parseInParallel();
+    void rollingWindow();
+    void batchSync();
+    void syncStatistics();
+    void commitInBatches();
+    void changeHistory();
+    void sharedFeed();
+    void occurrenceIndex();
+    void componentIndex();
+    void serveFeed();
+    void timezoneCache();
+    void resumeInterruptedDownload();
+    void abortImport();
+    void feedBudget();
+    void feedRecord();
 
 private:
+    void process(const QByteArray &icsData, const QByteArray &etag,
+                 const QByteArray &lastModified = QByteArray());
     void validate();
     void validateSecond();
     void validateThird();
+    void synchronize(WebCalClient *client);
 
     WebCalClient *mClient;
+    // Serves the feeds of the tests syncing through the network.
+    FeedServer *mServer;
     QString mNotebookUid;
 };
 
@@ -68,32 +114,66 @@ tst_WebCalClient::~tst_WebCalClient()
 void tst_WebCalClient::initTestCase()
 {
     qputenv("SQLITESTORAGEDB", "./db");
+    qputenv("XDG_CACHE_HOME", "./cache");
 
     QFile::remove("./db");
+    QDir("./cache").removeRecursively();
 }
 
 void tst_WebCalClient::cleanupTestCase()
 {
 }
 
-void tst_WebCalClient::init()
+static Buteo::SyncProfile webcalProfile(const QString &name, const QString &url = QString())
 {
-    Buteo::SyncProfile webcal(QStringLiteral("webcal-subscription"));
+    Buteo::SyncProfile webcal(name);
     webcal.merge(Buteo::Profile(QStringLiteral("webcal"), Buteo::Profile::TYPE_CLIENT));
-    mClient = new WebCalClient(QStringLiteral("webcal"), webcal, 0);
+    if (!url.isEmpty()) {
+        webcal.clientProfile()->setKey(QStringLiteral("remoteCalendar"), url);
+    }
+    return webcal;
+}
+
+void tst_WebCalClient::init()
+{
+    mClient = new WebCalClient(QStringLiteral("webcal"),
+                               webcalProfile(QStringLiteral("webcal-subscription")), 0);
+    mServer = new FeedServer;
+    QVERIFY(mServer->start());
 }
 
 void tst_WebCalClient::cleanup()
 {
+    delete(mServer);
     delete(mClient);
 }
 
+void tst_WebCalClient::process(const QByteArray &icsData, const QByteArray &etag,
+                               const QByteArray &lastModified)
+{
+    mClient->processData(mClient->mFeeds.first(), icsData, etag, lastModified);
+    mClient->commit();
+}
+
+void tst_WebCalClient::synchronize(WebCalClient *client)
+{
+    // Full synchronisation, through the network stack,
+    // of a client that the test may have initialised already.
+    if (client->mFeeds.isEmpty()) {
+        QVERIFY(client->init());
+    }
+    QSignalSpy success(client, &WebCalClient::success);
+    QSignalSpy error(client, &WebCalClient::error);
+    QVERIFY(client->startSync());
+    QTRY_COMPARE_WITH_TIMEOUT(success.count() + error.count(), 1, 30000);
+}
+
 void tst_WebCalClient::initCreateEmpty()
 {
     QVERIFY(mClient->init());
-    QVERIFY(!mClient->mNotebookUid.isEmpty());
-    mNotebookUid = mClient->mNotebookUid;
-    QVERIFY(mClient->mNotebookEtag.isEmpty());
+    QVERIFY(!mClient->mFeeds.first()->notebookUid.isEmpty());
+    mNotebookUid = mClient->mFeeds.first()->notebookUid;
+    QVERIFY(mClient->mFeeds.first()->etag.isEmpty());
 
     QVERIFY(mClient->mStorage);
     mKCal::Notebook::Ptr notebook = mClient->mStorage->notebook(mNotebookUid);
@@ -110,9 +190,9 @@ void tst_WebCalClient::initCreateWithLabel()
     client->setKey(QStringLiteral("label"), QStringLiteral("Web calendar"));
 
     QVERIFY(mClient->init());
-    QVERIFY(!mClient->mNotebookUid.isEmpty());
-    mNotebookUid = mClient->mNotebookUid;
-    QVERIFY(mClient->mNotebookEtag.isEmpty());
+    QVERIFY(!mClient->mFeeds.first()->notebookUid.isEmpty());
+    mNotebookUid = mClient->mFeeds.first()->notebookUid;
+    QVERIFY(mClient->mFeeds.first()->etag.isEmpty());
 
     QVERIFY(mClient->mStorage);
     mKCal::Notebook::Ptr notebook = mClient->mStorage->notebook(mNotebookUid);
@@ -128,8 +208,8 @@ void tst_WebCalClient::initCreateWithLabel()
 void tst_WebCalClient::initReuse()
 {
     QVERIFY(mClient->init());
-    QCOMPARE(mClient->mNotebookUid, mNotebookUid);
-    QVERIFY(mClient->mNotebookEtag.isEmpty());
+    QCOMPARE(mClient->mFeeds.first()->notebookUid, mNotebookUid);
+    QVERIFY(mClient->mFeeds.first()->etag.isEmpty());
 }
 
 static const QByteArray icsDataFirst(
@@ -177,7 +257,7 @@ void tst_WebCalClient::validate()
 void tst_WebCalClient::firstDownload()
 {
     QVERIFY(mClient->init());
-    mClient->processData(icsDataFirst, "\"etag\"");
+    process(icsDataFirst, "\"etag\"");
 
     const Buteo::SyncResults res(mClient->getSyncResults());
     QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
@@ -192,7 +272,7 @@ void tst_WebCalClient::firstDownload()
 void tst_WebCalClient::downloadWithSameEtag()
 {
     QVERIFY(mClient->init());
-    mClient->processData(icsDataFirst, "\"etag\"");
+    process(icsDataFirst, "\"etag\"");
 
     const Buteo::SyncResults res(mClient->getSyncResults());
     QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
@@ -258,15 +338,15 @@ void tst_WebCalClient::validateSecond()
 void tst_WebCalClient::downloadWithDifferentEtag()
 {
     QVERIFY(mClient->init());
-    mClient->processData(icsDataSecond, "\"etag2\"");
+    process(icsDataSecond, "\"etag2\"");
 
     const Buteo::SyncResults res(mClient->getSyncResults());
     QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
     QCOMPARE(res.targetResults().count(), 1);
     Buteo::ItemCounts counts(res.targetResults().first().localItems());
-    QCOMPARE(counts.added, unsigned(2));
-    QCOMPARE(counts.deleted, unsigned(1));
-    QCOMPARE(counts.modified, unsigned(0));
+    QCOMPARE(counts.added, unsigned(1));
+    QCOMPARE(counts.deleted, unsigned(0));
+    QCOMPARE(counts.modified, unsigned(1));
 
     validateSecond();
 }
@@ -278,7 +358,7 @@ void tst_WebCalClient::downloadWithMetaDataUpdateOnly()
     client->setKey(QStringLiteral("label"), QStringLiteral("Web calendar"));
 
     QVERIFY(mClient->init());
-    mClient->processData(icsDataSecond, "\"etag2\"");
+    process(icsDataSecond, "\"etag2\"");
 
     const Buteo::SyncResults res(mClient->getSyncResults());
     QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
@@ -339,18 +419,1370 @@ void tst_WebCalClient::validateThird()
 void tst_WebCalClient::downloadWithoutEtag()
 {
     QVERIFY(mClient->init());
-    mClient->processData(icsDataThird, "");
+    process(icsDataThird, "");
 
     const Buteo::SyncResults res(mClient->getSyncResults());
     QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
     QCOMPARE(res.targetResults().count(), 1);
     Buteo::ItemCounts counts(res.targetResults().first().localItems());
-    QCOMPARE(counts.added, unsigned(1));
-    QCOMPARE(counts.deleted, unsigned(2));
-    QCOMPARE(counts.modified, unsigned(0));
+    QCOMPARE(counts.added, unsigned(0));
+    QCOMPARE(counts.deleted, unsigned(1));
+    QCOMPARE(counts.modified, unsigned(1));
 
     validateThird();
 }
 
+void tst_WebCalClient::downloadWithUnchangedContent()
+{
+    QVERIFY(mClient->init());
+    process(icsDataThird, "\"etag3\"");
+
+    const Buteo::SyncResults res(mClient->getSyncResults());
+    QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+    QCOMPARE(res.targetResults().count(), 0);
+
+    QVERIFY(mClient->mStorage);
+    mKCal::Notebook::Ptr notebook = mClient->mStorage->notebook(mNotebookUid);
+    QVERIFY(notebook);
+    QCOMPARE(notebook->customProperty("etag"), QStringLiteral("\"etag3\""));
+
+    mKCal::ExtendedCalendar::Ptr cal(new mKCal::ExtendedCalendar(QTimeZone::utc()));
+    mKCal::ExtendedStorage::Ptr store = mKCal::ExtendedCalendar::defaultStorage(cal);
+    QVERIFY(store && store->open());
+    QVERIFY(store->loadNotebookIncidences(mNotebookUid));
+    QCOMPARE(cal->incidences().count(), 1);
+}
+
+void tst_WebCalClient::downloadInChunks()
+{
+    QVERIFY(mClient->init());
+    for (int i = 0; i < icsDataSecond.size(); i += 7) {
+        QVERIFY(mClient->readData(mClient->mFeeds.first(), icsDataSecond.mid(i, 7)));
+    }
+    process(QByteArray(), "\"etag4\"");
+
+    const Buteo::SyncResults res(mClient->getSyncResults());
+    QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+    QCOMPARE(res.targetResults().count(), 1);
+    Buteo::ItemCounts counts(res.targetResults().first().localItems());
+    QCOMPARE(counts.added, unsigned(1));
+    QCOMPARE(counts.deleted, unsigned(0));
+    QCOMPARE(counts.modified, unsigned(1));
+
+    mKCal::ExtendedCalendar::Ptr cal(new mKCal::ExtendedCalendar(QTimeZone::utc()));
+    mKCal::ExtendedStorage::Ptr store = mKCal::ExtendedCalendar::defaultStorage(cal);
+    QVERIFY(store && store->open());
+    QVERIFY(store->loadNotebookIncidences(mNotebookUid));
+    QCOMPARE(cal->incidences().count(), 2);
+    KCalendarCore::Incidence::Ptr ev = cal->incidence(QStringLiteral("609@education.gouv.fr"));
+    QVERIFY(ev);
+    QCOMPARE(ev->summary(), QStringLiteral("Rentrée scolaire des élèves - Zone B"));
+}
+
+void tst_WebCalClient::downloadTruncated()
+{
+    QVERIFY(mClient->init());
+    process(icsDataFirst.left(icsDataFirst.indexOf("SUMMARY")), "\"etag5\"");
+
+    const Buteo::SyncResults res(mClient->getSyncResults());
+    QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_FAILED);
+    QCOMPARE(res.minorCode(), Buteo::SyncResults::DATABASE_FAILURE);
+
+    mKCal::Notebook::Ptr notebook = mClient->mStorage->notebook(mNotebookUid);
+    QVERIFY(notebook);
+    QCOMPARE(notebook->customProperty("etag"), QStringLiteral("\"etag4\""));
+
+    mKCal::ExtendedCalendar::Ptr cal(new mKCal::ExtendedCalendar(QTimeZone::utc()));
+    mKCal::ExtendedStorage::Ptr store = mKCal::ExtendedCalendar::defaultStorage(cal);
+    QVERIFY(store && store->open());
+    QVERIFY(store->loadNotebookIncidences(mNotebookUid));
+    QCOMPARE(cal->incidences().count(), 2);
+}
+
+static const QByteArray icsDataFiltered(
+"BEGIN:VCALENDAR\n"
+"PRODID:-//test//NONSGML webcal//\n"
+"VERSION:2.0\n"
+"BEGIN:VEVENT\n"
+"UID:lecture-1\n"
+"DTSTART:20190902T080000Z\n"
+"DTEND:20190902T100000Z\n"
+"SUMMARY:Algebra lecture\n"
+"LOCATION:Room 101\n"
+"CATEGORIES:Lecture,Math\n"
+"END:VEVENT\n"
+"BEGIN:VEVENT\n"
+"UID:lecture-2\n"
+"DTSTART:20190902T080000Z\n"
+"DTEND:20190902T100000Z\n"
+"SUMMARY:Cancelled algebra lecture\n"
+"CATEGORIES:Lecture\n"
+"STATUS:CANCELLED\n"
+"END:VEVENT\n"
+"BEGIN:VEVENT\n"
+"UID:seminar-1\n"
+"DTSTART:20190903T080000Z\n"
+"DTEND:20190903T100000Z\n"
+"SUMMARY:Algebra seminar\n"
+"CATEGORIES:Seminar\n"
+"END:VEVENT\n"
+"BEGIN:VEVENT\n"
+"UID:lecture-3\n"
+"DTSTART:20180903T080000Z\n"
+"DTEND:20180903T100000Z\n"
+"SUMMARY:Algebra lecture\n"
+"CATEGORIES:Lecture\n"
+"END:VEVENT\n"
+"BEGIN:VEVENT\n"
+"UID:lecture-4\n"
+"DTSTART:20180903T080000Z\n"
+"DTEND:20180903T100000Z\n"
+"RRULE:FREQ=WEEKLY;COUNT=100\n"
+"SUMMARY:Weekly algebra lecture\n"
+"CATEGORIES:Lecture\n"
+"END:VEVENT\n"
+"BEGIN:VEVENT\n"
+"UID:lecture-5\n"
+"DTSTART:20190904T080000Z\n"
+"DTEND:20190904T100000Z\n"
+"SUMMARY:Geometry lecture\n"
+"CATEGORIES:Lecture\n"
+"END:VEVENT\n"
+"BEGIN:VTODO\n"
+"UID:homework-1\n"
+"DUE:20190904T080000Z\n"
+"SUMMARY:Algebra homework\n"
+"CATEGORIES:Lecture\n"
+"END:VTODO\n"
+"END:VCALENDAR\n");
+static QByteArray compress(const QByteArray &data, int windowBits)
+{
+    z_stream stream;
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return QByteArray();
+    }
+    QByteArray out(deflateBound(&stream, data.size()), '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData()));
+    stream.avail_in = data.size();
+    stream.next_out = reinterpret_cast<Bytef*>(out.data());
+    stream.avail_out = out.size();
+    deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return out;
+}
+
+void tst_WebCalClient::contentDecoding_data()
+{
+    QTest::addColumn<QByteArray>("encoding");
+    QTest::addColumn<QByteArray>("data");
+
+    QTest::newRow("identity") << QByteArray() << icsDataFirst;
+    QTest::newRow("gzip") << QByteArray("gzip") << compress(icsDataFirst, MAX_WBITS + 16);
+    QTest::newRow("deflate") << QByteArray("deflate") << compress(icsDataFirst, MAX_WBITS);
+    QTest::newRow("raw deflate") << QByteArray("deflate") << compress(icsDataFirst, -MAX_WBITS);
+}
+
+void tst_WebCalClient::contentDecoding()
+{
+    QFETCH(QByteArray, encoding);
+    QFETCH(QByteArray, data);
+
+    QVERIFY(!data.isEmpty());
+    ContentDecoder decoder(encoding);
+    QVERIFY(decoder.isValid());
+    QByteArray decoded;
+    for (int i = 0; i < data.size(); i += 5) {
+        QVERIFY(decoder.decode(data.mid(i, 5), &decoded));
+    }
+    QVERIFY(decoder.finish());
+    QCOMPARE(decoded, icsDataFirst);
+    QCOMPARE(decoder.encodedBytes(), qint64(data.size()));
+    QCOMPARE(decoder.decodedBytes(), qint64(icsDataFirst.size()));
+
+    if (!encoding.isEmpty()) {
+        ContentDecoder truncated(encoding);
+        QByteArray partial;
+        QVERIFY(truncated.decode(data.left(data.size() / 2), &partial));
+        QVERIFY(!truncated.finish());
+
+        // Decoding stops one byte past the limit.
+        ContentDecoder limited(encoding);
+        QByteArray head;
+        QVERIFY(limited.decode(data, &head, 100));
+        QCOMPARE(head, icsDataFirst.left(101));
+        QCOMPARE(limited.decodedBytes(), qint64(101));
+    }
+
+    QVERIFY(!ContentDecoder(QByteArray("compress")).isValid());
+}
+
+void tst_WebCalClient::resumeDownload()
+{
+    const QString uid = QStringLiteral("spool-test");
+    {
+        DownloadSpool spool(uid);
+        QVERIFY(!spool.isResumable());
+        QVERIFY(spool.start("\"etag-spool\"", "gzip"));
+        QVERIFY(spool.append(icsDataFirst.left(100)));
+        QVERIFY(spool.append(icsDataFirst.mid(100, 50)));
+        spool.close();
+    }
+
+    DownloadSpool spool(uid);
+    QVERIFY(spool.isResumable());
+    QCOMPARE(spool.size(), qint64(150));
+    QCOMPARE(spool.validator(), QByteArray("\"etag-spool\""));
+    QCOMPARE(spool.contentEncoding(), QByteArray("gzip"));
+
+    QVERIFY(spool.resume());
+    QByteArray replayed;
+    for (QByteArray data = spool.replay(); !data.isEmpty(); data = spool.replay()) {
+        replayed += data;
+    }
+    QCOMPARE(replayed, icsDataFirst.left(150));
+    QVERIFY(spool.append(icsDataFirst.mid(150)));
+    spool.close();
+    QCOMPARE(spool.size(), qint64(icsDataFirst.size()));
+
+    spool.remove();
+    QVERIFY(!DownloadSpool(uid).isResumable());
+    QVERIFY(!QFile::exists(DownloadSpool::directory() + QStringLiteral("/spool-test.part")));
+}
+
+void tst_WebCalClient::downloadWithSameDigest()
+{
+    QVERIFY(mClient->init());
+    process(icsDataSecond, QByteArray(), "Tue, 01 Oct 2019 10:00:00 GMT");
+
+    const Buteo::SyncResults res(mClient->getSyncResults());
+    QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+    QCOMPARE(res.targetResults().count(), 0);
+
+    mKCal::Notebook::Ptr notebook = mClient->mStorage->notebook(mNotebookUid);
+    QVERIFY(notebook);
+    QVERIFY(notebook->customProperty("etag").isEmpty());
+    QCOMPARE(notebook->customProperty("last-modified"),
+             QStringLiteral("Tue, 01 Oct 2019 10:00:00 GMT"));
+    QCOMPARE(notebook->customProperty("digest"),
+             QString::fromLatin1(QCryptographicHash::hash(icsDataSecond, QCryptographicHash::Sha256).toHex()));
+    QCOMPARE(notebook->customProperty("unchanged-syncs"), QStringLiteral("1"));
+}
+
+void tst_WebCalClient::downloadNotModified()
+{
+    QVERIFY(mClient->init());
+    QCOMPARE(mClient->mFeeds.first()->lastModified, QByteArray("Tue, 01 Oct 2019 10:00:00 GMT"));
+    mClient->processNotModified(mClient->mFeeds.first());
+    mClient->commit();
+
+    const Buteo::SyncResults res(mClient->getSyncResults());
+    QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+    QCOMPARE(res.targetResults().count(), 0);
+
+    // Nothing to write in the notebook, the record keeps the outcome.
+    QVERIFY(!mClient->mStorage);
+    FeedRecord record;
+    QVERIFY(record.load(mClient->getProfileName()));
+    QCOMPARE(record.entries().first().unchangedSyncs, 2);
+
+    mKCal::ExtendedCalendar::Ptr cal(new mKCal::ExtendedCalendar(QTimeZone::utc()));
+    mKCal::ExtendedStorage::Ptr store = mKCal::ExtendedCalendar::defaultStorage(cal);
+    QVERIFY(store && store->open());
+    mKCal::Notebook::Ptr notebook = store->notebook(mNotebookUid);
+    QVERIFY(notebook);
+    QCOMPARE(notebook->customProperty("unchanged-syncs"), QStringLiteral("1"));
+    QVERIFY(store->loadNotebookIncidences(mNotebookUid));
+    QCOMPARE(cal->incidences().count(), 2);
+}
+
+void tst_WebCalClient::parseWithFilter()
+{
+    Buteo::Profile profile(QStringLiteral("webcal"), Buteo::Profile::TYPE_CLIENT);
+    profile.setKey(QStringLiteral("filterStart"), QStringLiteral("2019-09-01"));
+    profile.setKey(QStringLiteral("includeCategories"), QStringLiteral("lecture"));
+    profile.setKey(QStringLiteral("excludeCategories"), QStringLiteral("Seminar"));
+    profile.setKey(QStringLiteral("summaryFilter"), QStringLiteral("^(weekly )?algebra"));
+    profile.setKey(QStringLiteral("incidenceTypes"), QStringLiteral("event"));
+    profile.setKey(QStringLiteral("excludeStatus"), QStringLiteral("cancelled"));
+
+    IcsStreamParser parser((IncidenceFilter(profile)));
+    QVERIFY(parser.append(icsDataFiltered));
+    QVERIFY(parser.finish());
+    QCOMPARE(parser.filteredCount(), 5);
+
+    QStringList uids;
+    for (const KCalendarCore::Incidence::Ptr &incidence : parser.incidences()) {
+        uids << incidence->uid();
+    }
+    uids.sort();
+    QCOMPARE(uids, QStringList() << QStringLiteral("lecture-1") << QStringLiteral("lecture-4"));
+}
+
+static const QByteArray icsDataProjected(
+"BEGIN:VCALENDAR\r\n"
+"VERSION:2.0\r\n"
+"PRODID:-//test//EN\r\n"
+"BEGIN:VEVENT\r\n"
+"UID:projected-1\r\n"
+"DTSTART:20191007T080000Z\r\n"
+"RRULE:FREQ=WEEKLY;COUNT=4\r\n"
+"SUMMARY:Algebra\r\n"
+"LOCATION:Room 1\r\n"
+"DESCRIPTION;ALTREP=\"http://example.org/a:b\":Première leçon\\, très longue\r\n"
+"X-ALT-DESC;FMTTYPE=text/html:<p>Première leçon</p>\r\n"
+"X-MICROSOFT-CDO-BUSYSTATUS:BUSY\r\n"
+"ATTACH;ENCODING=BASE64;VALUE=BINARY:SGVsbG8gd29ybGQ=\r\n"
+"BEGIN:VALARM\r\n"
+"ACTION:DISPLAY\r\n"
+"DESCRIPTION:Reminder with a long text\r\n"
+"TRIGGER:-PT15M\r\n"
+"END:VALARM\r\n"
+"END:VEVENT\r\n"
+"END:VCALENDAR\r\n");
+
+void tst_WebCalClient::parseWithProjection()
+{
+    Buteo::Profile profile(QStringLiteral("webcal"), Buteo::Profile::TYPE_CLIENT);
+    profile.setKey(QStringLiteral("dropProperties"), QStringLiteral("attach, x-*"));
+    // Cut in the middle of an UTF-8 sequence.
+    profile.setKey(QStringLiteral("maxDescriptionLength"), QStringLiteral("6"));
+    {
+        IcsStreamParser parser((IncidenceFilter(profile)));
+        QVERIFY(parser.append(icsDataProjected));
+        QVERIFY(parser.finish());
+        QCOMPARE(parser.incidences().count(), 1);
+        const KCalendarCore::Incidence::Ptr incidence = parser.incidences().first();
+        QCOMPARE(incidence->summary(), QStringLiteral("Algebra"));
+        QCOMPARE(incidence->location(), QStringLiteral("Room 1"));
+        QCOMPARE(incidence->description(), QString::fromUtf8("Premi\xE2\x80\xA6"));
+        QVERIFY(incidence->attachments().isEmpty());
+        QVERIFY(incidence->nonKDECustomProperty("X-ALT-DESC").isEmpty());
+        QVERIFY(incidence->nonKDECustomProperty("X-MICROSOFT-CDO-BUSYSTATUS").isEmpty());
+        QVERIFY(incidence->recurs());
+        // Alarms are not projected.
+        QCOMPARE(incidence->alarms().count(), 1);
+        QCOMPARE(incidence->alarms().first()->text(), QStringLiteral("Reminder with a long text"));
+    }
+
+    profile.setKey(QStringLiteral("dropProperties"), QString());
+    // Cut in the middle of an escaped comma.
+    profile.setKey(QStringLiteral("maxDescriptionLength"), QStringLiteral("17"));
+    {
+        IcsStreamParser parser((IncidenceFilter(profile)));
+        QVERIFY(parser.append(icsDataProjected));
+        QVERIFY(parser.finish());
+        QCOMPARE(parser.incidences().first()->description(),
+                 QString::fromUtf8("Première leçon\xE2\x80\xA6"));
+        QCOMPARE(parser.incidences().first()->attachments().count(), 1);
+    }
+
+    profile.setKey(QStringLiteral("maxDescriptionLength"), QString());
+    profile.setKey(QStringLiteral("keepProperties"), QStringLiteral("summary"));
+    const QByteArray signature = IncidenceFilter(profile).signature();
+    {
+        IcsStreamParser parser((IncidenceFilter(profile)));
+        QVERIFY(parser.append(icsDataProjected));
+        QVERIFY(parser.finish());
+        const KCalendarCore::Incidence::Ptr incidence = parser.incidences().first();
+        QCOMPARE(incidence->summary(), QStringLiteral("Algebra"));
+        QVERIFY(incidence->location().isEmpty());
+        QVERIFY(incidence->description().isEmpty());
+        QVERIFY(incidence->attachments().isEmpty());
+        QCOMPARE(incidence->dtStart(), QDateTime(QDate(2019, 10, 7), QTime(8, 0), Qt::UTC));
+        QVERIFY(incidence->recurs());
+    }
+
+    // Changing the projection imports the feed again.
+    profile.setKey(QStringLiteral("keepProperties"), QStringLiteral("summary,location"));
+    QVERIFY(IncidenceFilter(profile).signature() != signature);
+}
+
+void tst_WebCalClient::stringPool()
+{
+    StringPool pool;
+    const QString first = pool.intern(QString::fromLatin1("Room 1"));
+    const QString second = pool.intern(QString::fromLatin1("Room 1"));
+    QCOMPARE(second, first);
+    QCOMPARE(second.constData(), first.constData());
+    QCOMPARE(pool.count(), 1);
+    QCOMPARE(pool.hits(), 1);
+
+    QByteArray data("BEGIN:VCALENDAR\r\nVERSION:2.0\r\nPRODID:-//test//EN\r\n");
+    for (int i = 0; i < 3; i++) {
+        data += "BEGIN:VEVENT\r\nUID:pool-" + QByteArray::number(i) + "\r\n"
+            "DTSTART:20191001T100000Z\r\nSUMMARY:Event " + QByteArray::number(i) + "\r\n"
+            "CATEGORIES:Lecture,Math\r\nLOCATION:Room 1\r\n"
+            "ORGANIZER;CN=Teacher:mailto:teacher@example.org\r\n"
+            "X-MICROSOFT-CDO-BUSYSTATUS:BUSY\r\nEND:VEVENT\r\n";
+    }
+    data += "END:VCALENDAR\r\n";
+
+    IcsStreamParser parser;
+    QVERIFY(parser.append(data));
+    QVERIFY(parser.finish());
+    const KCalendarCore::Incidence::List incidences = parser.incidences();
+    QCOMPARE(incidences.count(), 3);
+    const KCalendarCore::Incidence::Ptr reference = incidences.first();
+    for (const KCalendarCore::Incidence::Ptr &incidence : incidences) {
+        QCOMPARE(incidence->categories(), QStringList() << QStringLiteral("Lecture") << QStringLiteral("Math"));
+        QCOMPARE(incidence->location(), QStringLiteral("Room 1"));
+        QCOMPARE(incidence->organizer().email(), QStringLiteral("teacher@example.org"));
+        // Values are shared, not copied.
+        QCOMPARE(incidence->location().constData(), reference->location().constData());
+        QCOMPARE(incidence->categories().first().constData(),
+                 reference->categories().first().constData());
+        QCOMPARE(incidence->organizer().name().constData(),
+                 reference->organizer().name().constData());
+        QCOMPARE(incidence->nonKDECustomProperty("X-MICROSOFT-CDO-BUSYSTATUS").constData(),
+                 reference->nonKDECustomProperty("X-MICROSOFT-CDO-BUSYSTATUS").constData());
+    }
+}
+
+void tst_WebCalClient::parseInParallel()
+{
+    // Enough components for several batches, some of them
+    // refering to a time zone defined at the end.
+    QByteArray data("BEGIN:VCALENDAR\r\nVERSION:2.0\r\nPRODID:-//test//EN\r\n");
+    QStringList expected;
+    QStringList deferred;
+    for (int i = 0; i < 300; i++) {
+        const QString uid = QStringLiteral("event-%1").arg(i);
+        data += "BEGIN:VEVENT\r\nUID:" + uid.toLatin1() + "\r\n";
+        if (i % 10) {
+            data += "DTSTART:20191001T100000Z\r\n";
+            expected << uid;
+        } else {
+            data += "DTSTART;TZID=Europe/Paris:20191001T100000\r\n";
+            deferred << uid;
+        }
+        data += "SUMMARY:Event " + QByteArray::number(i) + "\r\nEND:VEVENT\r\n";
+    }
+    data += "BEGIN:VTIMEZONE\r\nTZID:Europe/Paris\r\n"
+        "BEGIN:STANDARD\r\nDTSTART:19701025T030000\r\nRRULE:FREQ=YEARLY;BYMONTH=10;BYDAY=-1SU\r\n"
+        "TZOFFSETFROM:+0200\r\nTZOFFSETTO:+0100\r\nEND:STANDARD\r\n"
+        "BEGIN:DAYLIGHT\r\nDTSTART:19700329T020000\r\nRRULE:FREQ=YEARLY;BYMONTH=3;BYDAY=-1SU\r\n"
+        "TZOFFSETFROM:+0100\r\nTZOFFSETTO:+0200\r\nEND:DAYLIGHT\r\nEND:VTIMEZONE\r\n"
+        "END:VCALENDAR\r\n";
+    expected << deferred;
+
+    IcsStreamParser parser;
+    for (int i = 0; i < data.size(); i += 1000) {
+        QVERIFY(parser.append(data.mid(i, 1000)));
+    }
+    QVERIFY(parser.finish());
+
+    QStringList uids;
+    for (const KCalendarCore::Incidence::Ptr &incidence : parser.incidences()) {
+        uids << incidence->uid();
+    }
+    QCOMPARE(uids, expected);
+    const KCalendarCore::Incidence::Ptr paris = parser.incidences().last();
+    QCOMPARE(paris->dtStart().toUTC(), QDateTime(QDate(2019, 10, 1), QTime(8, 0), Qt::UTC));
+}
+
+void tst_WebCalClient::rollingWindow()
+{
+    Buteo::Profile profile(QStringLiteral("webcal"), Buteo::Profile::TYPE_CLIENT);
+    profile.setKey(QStringLiteral("pastDays"), QStringLiteral("30"));
+    profile.setKey(QStringLiteral("futureDays"), QStringLiteral("60"));
+
+    const QDateTime now(QDate(2019, 10, 3), QTime(12, 0), Qt::UTC);
+    const QDateTime today(now.date(), QTime(0, 0), Qt::UTC);
+    IncidenceFilter filter(profile, now);
+    QCOMPARE(filter.windowStart(), today.addDays(-30));
+    QCOMPARE(filter.windowEnd(), today.addDays(61 + 16));
+    QVERIFY(filter.covers(filter.windowStart(), filter.windowEnd()));
+    QVERIFY(filter.covers(QDateTime(), QDateTime()));
+
+    // The window moves, but is still covered by what was imported.
+    IncidenceFilter later(profile, now.addDays(10));
+    QVERIFY(later.covers(filter.windowStart(), filter.windowEnd()));
+    IncidenceFilter tooLate(profile, now.addDays(20));
+    QVERIFY(!tooLate.covers(filter.windowStart(), filter.windowEnd()));
+
+    // Scrolling back requires to import past incidences.
+    profile.setKey(QStringLiteral("pastDays"), QStringLiteral("60"));
+    IncidenceFilter past(profile, now);
+    QVERIFY(!past.covers(filter.windowStart(), filter.windowEnd()));
+
+    IcsStreamParser parser(filter);
+    QVERIFY(parser.append(icsDataFiltered));
+    QVERIFY(parser.finish());
+    QStringList uids;
+    for (const KCalendarCore::Incidence::Ptr &incidence : parser.incidences()) {
+        uids << incidence->uid();
+    }
+    uids.sort();
+    QCOMPARE(uids, QStringList() << QStringLiteral("homework-1")
+             << QStringLiteral("lecture-4") << QStringLiteral("lecture-5")
+             << QStringLiteral("seminar-1"));
+}
+
+void tst_WebCalClient::batchSync()
+{
+    Buteo::SyncProfile webcal(webcalProfile(QStringLiteral("webcal-batch")));
+    WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+    Buteo::Profile *profile = client.profile().clientProfile();
+    QVERIFY(profile);
+    profile->setKeyValues(QStringLiteral("remoteCalendar"), QStringList()
+                          << QStringLiteral("http://example.org/zone-a.ics")
+                          << QStringLiteral("http://example.org/zone-c.ics"));
+
+    QVERIFY(client.init());
+    QCOMPARE(client.mFeeds.count(), 2);
+    const QString first = client.mFeeds[0]->notebookUid;
+    const QString second = client.mFeeds[1]->notebookUid;
+    QVERIFY(!first.isEmpty());
+    QVERIFY(!second.isEmpty());
+    QVERIFY(first != second);
+
+    client.processData(client.mFeeds[0], icsDataFirst, "\"etag-a\"");
+    client.processData(client.mFeeds[1], icsDataThird, "\"etag-c\"");
+    client.commit();
+
+    const Buteo::SyncResults res(client.getSyncResults());
+    QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+    QCOMPARE(res.targetResults().count(), 2);
+
+    mKCal::ExtendedCalendar::Ptr cal(new mKCal::ExtendedCalendar(QTimeZone::utc()));
+    mKCal::ExtendedStorage::Ptr store = mKCal::ExtendedCalendar::defaultStorage(cal);
+    QVERIFY(store && store->open());
+    QVERIFY(store->loadNotebookIncidences(first));
+    QVERIFY(store->loadNotebookIncidences(second));
+    QCOMPARE(cal->incidences(first).count(), 1);
+    QCOMPARE(cal->incidences(first).first()->uid(), QStringLiteral("608@education.gouv.fr"));
+    QCOMPARE(cal->incidences(second).count(), 1);
+    QCOMPARE(cal->incidences(second).first()->uid(), QStringLiteral("609@education.gouv.fr"));
+    QCOMPARE(store->notebook(first)->customProperty("url"),
+             QStringLiteral("http://example.org/zone-a.ics"));
+
+    // Notebooks are found back by their URL.
+    profile->setKeyValues(QStringLiteral("remoteCalendar"), QStringList()
+                          << QStringLiteral("http://example.org/zone-c.ics")
+                          << QStringLiteral("http://example.org/zone-a.ics"));
+    QVERIFY(client.init());
+    QCOMPARE(client.mFeeds[0]->notebookUid, second);
+    QCOMPARE(client.mFeeds[1]->notebookUid, first);
+
+    QVERIFY(client.cleanUp());
+    QVERIFY(!client.mStorage->notebook(first));
+    QVERIFY(!client.mStorage->notebook(second));
+}
+
+void tst_WebCalClient::syncStatistics()
+{
+    Buteo::SyncProfile webcal(webcalProfile(QStringLiteral("webcal-statistics")));
+    WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+    QVERIFY(client.init());
+    SyncHistory history(QStringLiteral("webcal-statistics"));
+    QFile::remove(history.path());
+
+    client.processData(client.mFeeds.first(), icsDataFirst, "\"etag-stats\"");
+    client.commit();
+    QCOMPARE(client.getSyncResults().majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+
+    const QJsonArray feeds = client.mStatistics.value(QStringLiteral("feeds")).toArray();
+    QCOMPARE(feeds.count(), 1);
+    const QJsonObject feed = feeds.first().toObject();
+    QCOMPARE(feed.value(QStringLiteral("state")).toString(), QStringLiteral("modified"));
+    QCOMPARE(feed.value(QStringLiteral("parsed")).toInt(), 1);
+    QCOMPARE(feed.value(QStringLiteral("added")).toInt(), 1);
+    QVERIFY(feed.value(QStringLiteral("parseMs")).toDouble() > 0.);
+    QVERIFY(client.mStatistics.contains(QStringLiteral("saveMs")));
+
+    client.processNotModified(client.mFeeds.first());
+    client.commit();
+    const QJsonArray records = history.records();
+    QCOMPARE(records.count(), 2);
+    QCOMPARE(records.last().toObject().value(QStringLiteral("feeds")).toArray()
+             .first().toObject().value(QStringLiteral("state")).toString(),
+             QStringLiteral("not-modified"));
+
+    QVERIFY(client.cleanUp());
+}
+
+static QByteArray generatedFeed(int from, int to, const QByteArray &summary)
+{
+    QByteArray data("BEGIN:VCALENDAR\r\nVERSION:2.0\r\nPRODID:-//test//EN\r\n");
+    for (int i = from; i < to; i++) {
+        data += "BEGIN:VEVENT\r\nUID:batch-" + QByteArray::number(i) + "\r\n"
+            "DTSTART:20191001T100000Z\r\nSUMMARY:" + summary + "\r\nEND:VEVENT\r\n";
+    }
+    return data + "END:VCALENDAR\r\n";
+}
+
+void tst_WebCalClient::commitInBatches()
+{
+    Buteo::SyncProfile webcal(webcalProfile(QStringLiteral("webcal-commit")));
+    Buteo::Profile *profile = webcal.clientProfile();
+    profile->setKey(QStringLiteral("commitBatchSize"), QStringLiteral("3"));
+
+    QString notebookUid;
+    {
+        WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+        QVERIFY(client.init());
+        const QString emptyUid = client.mFeeds.first()->notebookUid;
+        client.processData(client.mFeeds.first(), generatedFeed(0, 10, "first"), "\"etag-commit1\"");
+        client.commit();
+        const Buteo::SyncResults res(client.getSyncResults());
+        QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+        QCOMPARE(res.targetResults().first().localItems().added, unsigned(10));
+        // Saved incidences are not kept in memory.
+        QVERIFY(client.mCalendar->incidences().isEmpty());
+
+        // More changes than a batch: imported in a staging notebook
+        // that replaced the previous one.
+        notebookUid = client.mFeeds.first()->notebookUid;
+        QVERIFY(notebookUid != emptyUid);
+        QVERIFY(!client.mStorage->notebook(emptyUid));
+        mKCal::Notebook::Ptr notebook = client.mStorage->notebook(notebookUid);
+        QVERIFY(notebook);
+        QVERIFY(notebook->isVisible());
+        QVERIFY(notebook->customProperty("staging-for").isEmpty());
+    }
+
+    // Simulate an import that was interrupted.
+    {
+        mKCal::ExtendedCalendar::Ptr cal(new mKCal::ExtendedCalendar(QTimeZone::utc()));
+        mKCal::ExtendedStorage::Ptr store = mKCal::ExtendedCalendar::defaultStorage(cal);
+        QVERIFY(store && store->open());
+        mKCal::Notebook::Ptr staging(new mKCal::Notebook(QStringLiteral("staging"), QString()));
+        staging->setPluginName(QStringLiteral("webcal"));
+        staging->setSyncProfile(QStringLiteral("webcal-commit"));
+        staging->setIsVisible(false);
+        staging->setCustomProperty("staging-for", notebookUid);
+        QVERIFY(store->addNotebook(staging));
+        // And a replaced notebook that could not be deleted.
+        mKCal::Notebook::Ptr replaced(new mKCal::Notebook(QStringLiteral("replaced"), QString()));
+        replaced->setPluginName(QStringLiteral("webcal"));
+        replaced->setSyncProfile(QStringLiteral("webcal-commit"));
+        replaced->setIsVisible(false);
+        replaced->setCustomProperty("replaced-by", notebookUid);
+        QVERIFY(store->addNotebook(replaced));
+        QVERIFY(FeedRecord::markImporting(QStringLiteral("webcal-commit")));
+    }
+
+    // The record of an interrupted import is not used by init(),
+    // leftovers are dropped while opening storage.
+    WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+    QVERIFY(client.init());
+    QVERIFY(client.mStorage);
+    QCOMPARE(client.mFeeds.first()->notebookUid, notebookUid);
+    int count = 0;
+    for (const mKCal::Notebook::Ptr &notebook : client.mStorage->notebooks()) {
+        count += notebook->syncProfile() == QStringLiteral("webcal-commit") ? 1 : 0;
+    }
+    QCOMPARE(count, 1);
+
+    // Shift the feed: 4 deletions, 4 additions and 6 updates.
+    client.processData(client.mFeeds.first(), generatedFeed(4, 14, "second"), "\"etag-commit2\"");
+    client.commit();
+    const Buteo::SyncResults res(client.getSyncResults());
+    QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+    const Buteo::ItemCounts counts(res.targetResults().first().localItems());
+    QCOMPARE(counts.added, unsigned(4));
+    QCOMPARE(counts.modified, unsigned(6));
+    QCOMPARE(counts.deleted, unsigned(4));
+    QVERIFY(client.mFeeds.first()->notebookUid != notebookUid);
+    notebookUid = client.mFeeds.first()->notebookUid;
+
+    mKCal::ExtendedCalendar::Ptr cal(new mKCal::ExtendedCalendar(QTimeZone::utc()));
+    mKCal::ExtendedStorage::Ptr store = mKCal::ExtendedCalendar::defaultStorage(cal);
+    QVERIFY(store && store->open());
+    QVERIFY(store->loadNotebookIncidences(notebookUid));
+    QCOMPARE(cal->incidences().count(), 10);
+    for (const KCalendarCore::Incidence::Ptr &incidence : cal->incidences()) {
+        QCOMPARE(incidence->summary(), QStringLiteral("second"));
+    }
+    mKCal::Notebook::Ptr notebook = store->notebook(notebookUid);
+    QVERIFY(notebook);
+    QCOMPARE(notebook->customProperty("etag"), QStringLiteral("\"etag-commit2\""));
+
+    // Changes fitting in a batch are done in place.
+    profile->setKey(QStringLiteral("commitBatchSize"), QStringLiteral("500"));
+    WebCalClient inPlace(QStringLiteral("webcal"), webcal, 0);
+    QVERIFY(inPlace.init());
+    inPlace.processData(inPlace.mFeeds.first(), generatedFeed(4, 15, "second"), "\"etag-commit3\"");
+    inPlace.commit();
+    QCOMPARE(inPlace.getSyncResults().majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+    QCOMPARE(inPlace.mFeeds.first()->notebookUid, notebookUid);
+
+    // Except when an incidence changes type: it is deleted and added
+    // back, which cannot be done by a single save.
+    QByteArray replacing = generatedFeed(4, 15, "second");
+    replacing.replace("BEGIN:VEVENT\r\nUID:batch-4\r\nDTSTART:20191001T100000Z\r\nSUMMARY:second\r\nEND:VEVENT",
+                      "BEGIN:VTODO\r\nUID:batch-4\r\nDTSTART:20191001T100000Z\r\nSUMMARY:second\r\nEND:VTODO");
+    inPlace.processData(inPlace.mFeeds.first(), replacing, "\"etag-commit4\"");
+    inPlace.commit();
+    QCOMPARE(inPlace.getSyncResults().majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+    QVERIFY(inPlace.mFeeds.first()->notebookUid != notebookUid);
+    mKCal::ExtendedCalendar::Ptr replaced(new mKCal::ExtendedCalendar(QTimeZone::utc()));
+    mKCal::ExtendedStorage::Ptr replacedStore = mKCal::ExtendedCalendar::defaultStorage(replaced);
+    QVERIFY(replacedStore && replacedStore->open());
+    QVERIFY(replacedStore->loadNotebookIncidences(inPlace.mFeeds.first()->notebookUid));
+    QCOMPARE(replaced->incidences().count(), 11);
+    QCOMPARE(replaced->todos().count(), 1);
+
+    QVERIFY(inPlace.cleanUp());
+}
+
+void tst_WebCalClient::changeHistory()
+{
+    QCOMPARE(ChangeHistory::cacheLifetime("public, max-age=7200", QByteArray(), QByteArray()),
+             qint64(7200));
+    QCOMPARE(ChangeHistory::cacheLifetime("no-cache", "Tue, 01 Oct 2019 12:00:00 GMT",
+                                          "Tue, 01 Oct 2019 10:00:00 GMT"), qint64(-1));
+    QCOMPARE(ChangeHistory::cacheLifetime(QByteArray(), "Tue, 01 Oct 2019 12:00:00 GMT",
+                                          "Tue, 01 Oct 2019 10:00:00 GMT"), qint64(7200));
+    QCOMPARE(ChangeHistory::cacheLifetime(QByteArray(), QByteArray(), QByteArray()), qint64(-1));
+
+    // Without history, sync daily.
+    QCOMPARE(ChangeHistory().recommendedInterval(), qint64(86400));
+
+    // A feed changing every 6 hours is polled every 3 hours.
+    const QDateTime start(QDate(2019, 10, 1), QTime(0, 0), Qt::UTC);
+    ChangeHistory history;
+    for (int i = 0; i < 4; i++) {
+        history.record(ChangeHistory::Changed, start.addSecs(i * 6 * 3600));
+    }
+    QCOMPARE(history.recommendedInterval(), qint64(3 * 3600));
+    // But not before the content expires.
+    QCOMPARE(history.recommendedInterval(5 * 3600), qint64(5 * 3600));
+
+    // Back off when unchanged or failing, up to a week.
+    history.record(ChangeHistory::Unchanged, start.addDays(1));
+    QCOMPARE(history.recommendedInterval(), qint64(6 * 3600));
+    for (int i = 0; i < 10; i++) {
+        history.record(ChangeHistory::Failed, start.addDays(2 + i));
+    }
+    QCOMPARE(history.recommendedInterval(), qint64(48 * 3600));
+
+    const ChangeHistory restored(history.toString());
+    QCOMPARE(restored.toString(), history.toString());
+    QCOMPARE(restored.recommendedInterval(), history.recommendedInterval());
+}
+
+void tst_WebCalClient::sharedFeed()
+{
+    const QString url = QStringLiteral("http://example.org/shared.ics");
+    const Buteo::SyncProfile first(webcalProfile(QStringLiteral("webcal-shared-a"), url));
+    const Buteo::SyncProfile second(webcalProfile(QStringLiteral("webcal-shared-b"), url));
+
+    WebCalClient a(QStringLiteral("webcal"), first, 0);
+    QVERIFY(a.init());
+    QVERIFY(a.mFeeds.first()->donorUid.isEmpty());
+    a.processData(a.mFeeds.first(), icsDataFirst, "\"etag-shared\"");
+    a.commit();
+    QCOMPARE(a.getSyncResults().majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+
+    // The second profile reuses what the first one imported.
+    {
+        WebCalClient b(QStringLiteral("webcal"), second, 0);
+        QVERIFY(b.init());
+        QCOMPARE(b.mFeeds.first()->donorUid, a.mFeeds.first()->notebookUid);
+        b.processDonor(b.mFeeds.first());
+        QCOMPARE(int(b.mFeeds.first()->state), int(WebCalClient::Feed::Modified));
+        b.commit();
+        const Buteo::SyncResults res(b.getSyncResults());
+        QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+        QCOMPARE(res.targetResults().first().localItems().added, unsigned(1));
+
+        mKCal::Notebook::Ptr notebook = b.mStorage->notebook(b.mFeeds.first()->notebookUid);
+        QVERIFY(notebook);
+        QCOMPARE(notebook->customProperty("etag"), QStringLiteral("\"etag-shared\""));
+        QCOMPARE(notebook->customProperty("digest"),
+                 a.mStorage->notebook(a.mFeeds.first()->notebookUid)->customProperty("digest"));
+
+        mKCal::ExtendedCalendar::Ptr cal(new mKCal::ExtendedCalendar(QTimeZone::utc()));
+        mKCal::ExtendedStorage::Ptr store = mKCal::ExtendedCalendar::defaultStorage(cal);
+        QVERIFY(store && store->open());
+        QVERIFY(store->loadNotebookIncidences(notebook->uid()));
+        QCOMPARE(cal->incidences(notebook->uid()).count(), 1);
+    }
+
+    // Nothing to do when both have the same content.
+    WebCalClient b(QStringLiteral("webcal"), second, 0);
+    QVERIFY(b.init());
+    b.processDonor(b.mFeeds.first());
+    QCOMPARE(int(b.mFeeds.first()->state), int(WebCalClient::Feed::NotModified));
+
+    QVERIFY(b.cleanUp());
+    QVERIFY(a.cleanUp());
+}
+
+void tst_WebCalClient::occurrenceIndex()
+{
+    const QByteArray data("BEGIN:VCALENDAR\r\nVERSION:2.0\r\nPRODID:-//test//EN\r\n"
+                          "BEGIN:VEVENT\r\nUID:weekly\r\nDTSTART:20191007T080000Z\r\n"
+                          "DTEND:20191007T100000Z\r\nRRULE:FREQ=WEEKLY\r\n"
+                          "EXDATE:20191014T080000Z\r\nSUMMARY:Lecture\r\nEND:VEVENT\r\n"
+                          "BEGIN:VEVENT\r\nUID:weekly\r\nRECURRENCE-ID:20191021T080000Z\r\n"
+                          "DTSTART:20191021T130000Z\r\nDTEND:20191021T150000Z\r\n"
+                          "SUMMARY:Lecture moved\r\nEND:VEVENT\r\n"
+                          "BEGIN:VEVENT\r\nUID:single\r\nDTSTART:20191009T120000Z\r\n"
+                          "DTEND:20191009T130000Z\r\nSUMMARY:Meeting\r\nEND:VEVENT\r\n"
+                          "END:VCALENDAR\r\n");
+    IcsStreamParser parser;
+    QVERIFY(parser.append(data));
+    QVERIFY(parser.finish());
+
+    const QDateTime start(QDate(2019, 10, 1), QTime(0, 0), Qt::UTC);
+    OccurrenceIndex index;
+    index.setWindow(start, start.addDays(31));
+    for (const KCalendarCore::Incidence::Ptr &incidence : parser.incidences()) {
+        QVERIFY(!index.contains(incidence));
+        index.insert(incidence);
+        QVERIFY(index.contains(incidence));
+    }
+    QCOMPARE(index.count(), 3);
+
+    QVERIFY(index.save(QStringLiteral("index-test")));
+    OccurrenceIndex loaded;
+    QVERIFY(loaded.load(QStringLiteral("index-test")));
+    QCOMPARE(loaded.windowStart(), start);
+    QCOMPARE(loaded.count(), 3);
+
+    // 14th is excluded, 21st is moved by an exception.
+    const QList<OccurrenceIndex::Occurrence> occurrences =
+        loaded.occurrences(start, start.addDays(31));
+    QCOMPARE(occurrences.count(), 4);
+    QCOMPARE(occurrences[0].uid, QStringLiteral("weekly"));
+    QCOMPARE(occurrences[0].start, QDateTime(QDate(2019, 10, 7), QTime(8, 0), Qt::UTC));
+    QCOMPARE(occurrences[0].end, QDateTime(QDate(2019, 10, 7), QTime(10, 0), Qt::UTC));
+    QCOMPARE(occurrences[1].uid, QStringLiteral("single"));
+    QCOMPARE(occurrences[2].start, QDateTime(QDate(2019, 10, 21), QTime(13, 0), Qt::UTC));
+    QCOMPARE(occurrences[3].start, QDateTime(QDate(2019, 10, 28), QTime(8, 0), Qt::UTC));
+    QCOMPARE(loaded.occurrences(start.addDays(8), start.addDays(9)).count(), 1);
+
+    // Moving the window drops everything.
+    loaded.setWindow(start.addDays(1), start.addDays(32));
+    QCOMPARE(loaded.count(), 0);
+
+    OccurrenceIndex::remove(QStringLiteral("index-test"));
+    QVERIFY(!OccurrenceIndex().load(QStringLiteral("index-test")));
+}
+
+void tst_WebCalClient::componentIndex()
+{
+    Buteo::SyncProfile webcal(webcalProfile(QStringLiteral("webcal-components")));
+
+    const QByteArray first = generatedFeed(0, 3, "first");
+    QByteArray second = first;
+    second.replace("UID:batch-2\r\nDTSTART:20191001T100000Z\r\nSUMMARY:first",
+                   "UID:batch-2\r\nDTSTART:20191001T100000Z\r\nSUMMARY:changed");
+    second.replace("END:VCALENDAR", "BEGIN:VEVENT\r\nUID:batch-3\r\nDTSTART:20191001T100000Z\r\n"
+                   "SUMMARY:added\r\nEND:VEVENT\r\nEND:VCALENDAR");
+
+    QString notebookUid;
+    {
+        WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+        QVERIFY(client.init());
+        notebookUid = client.mFeeds.first()->notebookUid;
+        client.processData(client.mFeeds.first(), first, "\"etag-components1\"");
+        QVERIFY(client.mFeeds.first()->parser->skippedFingerprints().isEmpty());
+        client.commit();
+        QCOMPARE(client.getSyncResults().majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+        ComponentIndex index;
+        QVERIFY(index.load(notebookUid));
+        QCOMPARE(index.count(), 3);
+    }
+
+    {
+        // Only the changed and the new components are parsed.
+        WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+        QVERIFY(client.init());
+        client.processData(client.mFeeds.first(), second, "\"etag-components2\"");
+        QCOMPARE(client.mFeeds.first()->skipped, 2);
+        QCOMPARE(client.mFeeds.first()->parsed, 2);
+        client.commit();
+        const Buteo::SyncResults res(client.getSyncResults());
+        QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+        QCOMPARE(res.targetResults().first().localItems().added, unsigned(1));
+        QCOMPARE(res.targetResults().first().localItems().modified, unsigned(1));
+        QCOMPARE(res.targetResults().first().localItems().deleted, unsigned(0));
+        ComponentIndex index;
+        QVERIFY(index.load(notebookUid));
+        QCOMPARE(index.count(), 4);
+    }
+
+    mKCal::ExtendedCalendar::Ptr cal(new mKCal::ExtendedCalendar(QTimeZone::utc()));
+    mKCal::ExtendedStorage::Ptr store = mKCal::ExtendedCalendar::defaultStorage(cal);
+    QVERIFY(store && store->open());
+    QVERIFY(store->loadNotebookIncidences(notebookUid));
+    QCOMPARE(cal->incidences(notebookUid).count(), 4);
+    QCOMPARE(cal->incidence(QStringLiteral("batch-1"))->summary(), QStringLiteral("first"));
+    QCOMPARE(cal->incidence(QStringLiteral("batch-2"))->summary(), QStringLiteral("changed"));
+
+    // Storage modified behind the index: the feed is requested
+    // again in the same sync, and parsed from scratch.
+    QVERIFY(cal->deleteIncidence(cal->incidence(QStringLiteral("batch-0"))));
+    QVERIFY(store->save(mKCal::ExtendedStorage::PurgeDeleted));
+    mServer->setFeed(QStringLiteral("/components.ics"), first, "\"etag-components3\"");
+    webcal.clientProfile()->setKey(QStringLiteral("remoteCalendar"),
+                                   mServer->url(QStringLiteral("/components.ics")));
+    {
+        WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+        QVERIFY(client.init());
+        QCOMPARE(client.mFeeds.first()->notebookUid, notebookUid);
+        synchronize(&client);
+        const Buteo::SyncResults res(client.getSyncResults());
+        QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+        QCOMPARE(mServer->requestCount(QStringLiteral("/components.ics")), 2);
+        QVERIFY(mServer->lastHeader(QStringLiteral("/components.ics"), "if-none-match").isEmpty());
+        QCOMPARE(client.mFeeds.first()->skipped, 0);
+        QCOMPARE(res.targetResults().first().localItems().added, unsigned(1));
+        ComponentIndex index;
+        QVERIFY(index.load(notebookUid));
+        QCOMPARE(index.count(), 3);
+        QVERIFY(client.cleanUp());
+    }
+    QVERIFY(!QFile::exists(ComponentIndex::path(notebookUid)));
+}
+
+void tst_WebCalClient::serveFeed()
+{
+    mServer->setFeed(QStringLiteral("/zone-a.ics"), icsDataFirst, "\"etag-served\"", QByteArray(),
+                     FeedServer::Chunked | FeedServer::Gzip);
+    mServer->setRedirect(QStringLiteral("/moved.ics"), QStringLiteral("/zone-a.ics"));
+    mServer->setThrottle(64, 5);
+
+    Buteo::SyncProfile webcal(webcalProfile(QStringLiteral("webcal-served"),
+                                            mServer->url(QStringLiteral("/moved.ics"))));
+    Buteo::Profile *profile = webcal.clientProfile();
+    profile->setKey(QStringLiteral("allowRedirect"), QStringLiteral("true"));
+
+    {
+        // Redirected, gzip encoded and chunked over a slow link.
+        WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+        synchronize(&client);
+        const Buteo::SyncResults res(client.getSyncResults());
+        QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+        QCOMPARE(res.targetResults().count(), 1);
+        QCOMPARE(res.targetResults().first().localItems().added, unsigned(1));
+        QCOMPARE(mServer->requestCount(QStringLiteral("/moved.ics")), 1);
+        QCOMPARE(mServer->requestCount(QStringLiteral("/zone-a.ics")), 1);
+        QVERIFY(mServer->lastHeader(QStringLiteral("/zone-a.ics"), "accept-encoding").contains("gzip"));
+        QVERIFY(client.mFeeds.first()->transferredBytes < client.mFeeds.first()->contentBytes);
+        QCOMPARE(client.mFeeds.first()->contentBytes, qint64(icsDataFirst.size()));
+    }
+
+    {
+        // Answered by 304 on the ETag.
+        WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+        synchronize(&client);
+        const Buteo::SyncResults res(client.getSyncResults());
+        QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+        QVERIFY(res.targetResults().isEmpty());
+        QCOMPARE(mServer->requestCount(QStringLiteral("/zone-a.ics")), 2);
+        QCOMPARE(mServer->lastHeader(QStringLiteral("/zone-a.ics"), "if-none-match"),
+                 QByteArray("\"etag-served\""));
+        QCOMPARE(client.mFeeds.first()->state, WebCalClient::Feed::NotModified);
+    }
+
+    // Without ETag, Last-Modified is used.
+    const QByteArray lastModified("Wed, 02 Oct 2019 08:00:00 GMT");
+    mServer->setFeed(QStringLiteral("/zone-a.ics"), icsDataSecond, QByteArray(), lastModified);
+    mServer->setThrottle(0, 0);
+    {
+        WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+        synchronize(&client);
+        const Buteo::SyncResults res(client.getSyncResults());
+        QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+        QCOMPARE(client.mFeeds.first()->state, WebCalClient::Feed::Modified);
+    }
+    {
+        WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+        synchronize(&client);
+        QCOMPARE(mServer->lastHeader(QStringLiteral("/zone-a.ics"), "if-modified-since"), lastModified);
+        QCOMPARE(client.mFeeds.first()->state, WebCalClient::Feed::NotModified);
+        QVERIFY(client.cleanUp());
+    }
+}
+
+static const QByteArray icsDataTimezones(
+"BEGIN:VCALENDAR\r\n"
+"VERSION:2.0\r\n"
+"PRODID:Microsoft Exchange Server 2010\r\n"
+"BEGIN:VTIMEZONE\r\n"
+"TZID:W. Europe Standard Time\r\n"
+"BEGIN:STANDARD\r\n"
+"DTSTART:16010101T030000\r\n"
+"TZOFFSETFROM:+0200\r\n"
+"TZOFFSETTO:+0100\r\n"
+"RRULE:FREQ=YEARLY;INTERVAL=1;BYDAY=-1SU;BYMONTH=10\r\n"
+"END:STANDARD\r\n"
+"BEGIN:DAYLIGHT\r\n"
+"DTSTART:16010101T020000\r\n"
+"TZOFFSETFROM:+0100\r\n"
+"TZOFFSETTO:+0200\r\n"
+"RRULE:FREQ=YEARLY;INTERVAL=1;BYDAY=-1SU;BYMONTH=3\r\n"
+"END:DAYLIGHT\r\n"
+"END:VTIMEZONE\r\n"
+"BEGIN:VTIMEZONE\r\n"
+"TZID:America/New_York\r\n"
+"LAST-MODIFIED:20201011T015911Z\r\n"
+"BEGIN:STANDARD\r\n"
+"DTSTART:19701101T020000\r\n"
+"TZOFFSETFROM:-0400\r\n"
+"TZOFFSETTO:-0500\r\n"
+"RRULE:FREQ=YEARLY;BYMONTH=11;BYDAY=1SU\r\n"
+"END:STANDARD\r\n"
+"BEGIN:DAYLIGHT\r\n"
+"DTSTART:19700308T020000\r\n"
+"TZOFFSETFROM:-0500\r\n"
+"TZOFFSETTO:-0400\r\n"
+"RRULE:FREQ=YEARLY;BYMONTH=3;BYDAY=2SU\r\n"
+"END:DAYLIGHT\r\n"
+"END:VTIMEZONE\r\n"
+"BEGIN:VEVENT\r\n"
+"UID:exchange-1\r\n"
+"DTSTART;TZID=\"W. Europe Standard Time\":20190715T090000\r\n"
+"DTEND;TZID=W. Europe Standard Time:20190715T100000\r\n"
+"RRULE:FREQ=WEEKLY;COUNT=30\r\n"
+"EXDATE;TZID=W. Europe Standard Time:20190722T090000\r\n"
+"SUMMARY:Weekly meeting\r\n"
+"END:VEVENT\r\n"
+"BEGIN:VEVENT\r\n"
+"UID:google-1\r\n"
+"DTSTART;TZID=America/New_York:20191215T180000\r\n"
+"DTEND;TZID=America/New_York:20191215T190000\r\n"
+"SUMMARY:Evening call\r\n"
+"END:VEVENT\r\n"
+"END:VCALENDAR\r\n");
+
+void tst_WebCalClient::timezoneCache()
+{
+    QFile::remove(TimezoneCache::path());
+
+    // Reference, parsing the definitions with every component.
+    QHash<QString, KCalendarCore::Incidence::Ptr> expected;
+    {
+        IcsStreamParser parser;
+        QVERIFY(parser.append(icsDataTimezones));
+        QVERIFY(parser.finish());
+        for (const KCalendarCore::Incidence::Ptr &incidence : parser.incidences()) {
+            expected.insert(incidence->uid(), incidence);
+        }
+        QCOMPARE(expected.count(), 2);
+    }
+
+    for (int sync = 0; sync < 2; sync++) {
+        TimezoneCache cache;
+        cache.load();
+        IcsStreamParser parser(IncidenceFilter(), &cache);
+        QVERIFY(parser.append(icsDataTimezones));
+        QVERIFY(parser.finish());
+        // Definitions are only resolved on the first sync.
+        QCOMPARE(cache.count(), 2);
+        QCOMPARE(cache.misses(), sync ? 0 : 2);
+        QCOMPARE(cache.hits(), sync ? 2 : 0);
+        QVERIFY(cache.save());
+
+        QCOMPARE(parser.incidences().count(), 2);
+        for (const KCalendarCore::Incidence::Ptr &incidence : parser.incidences()) {
+            const KCalendarCore::Incidence::Ptr reference = expected.value(incidence->uid());
+            QVERIFY(reference);
+            QCOMPARE(incidence->dtStart(), reference->dtStart());
+            QCOMPARE(incidence->dtStart().timeZone(), reference->dtStart().timeZone());
+            QCOMPARE(incidence->dateTime(KCalendarCore::Incidence::RoleEnd),
+                     reference->dateTime(KCalendarCore::Incidence::RoleEnd));
+            QCOMPARE(incidence->recurrence()->exDateTimes(), reference->recurrence()->exDateTimes());
+            QCOMPARE(IcsStreamParser::fingerprint(incidence), IcsStreamParser::fingerprint(reference));
+        }
+    }
+    QFile::remove(TimezoneCache::path());
+}
+
+void tst_WebCalClient::resumeInterruptedDownload()
+{
+    const QByteArray content = generatedFeed(0, 4000, "served");
+    mServer->setFeed(QStringLiteral("/large.ics"), content, "\"etag-large\"", QByteArray(),
+                     FeedServer::Ranges);
+    mServer->setDisconnectAfter(QStringLiteral("/large.ics"), 100000);
+
+    Buteo::SyncProfile webcal(webcalProfile(QStringLiteral("webcal-interrupted"),
+                                            mServer->url(QStringLiteral("/large.ics"))));
+
+    QString notebookUid;
+    {
+        WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+        QVERIFY(client.init());
+        notebookUid = client.mFeeds.first()->notebookUid;
+        synchronize(&client);
+        const Buteo::SyncResults res(client.getSyncResults());
+        QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_FAILED);
+        QVERIFY(DownloadSpool(notebookUid).isResumable());
+        QCOMPARE(DownloadSpool(notebookUid).size(), qint64(100000));
+    }
+
+    {
+        WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+        synchronize(&client);
+        const Buteo::SyncResults res(client.getSyncResults());
+        QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+        QCOMPARE(res.targetResults().first().localItems().added, unsigned(4000));
+        QCOMPARE(mServer->requestCount(QStringLiteral("/large.ics")), 2);
+        QCOMPARE(mServer->lastHeader(QStringLiteral("/large.ics"), "range"), QByteArray("bytes=100000-"));
+        // Only the remaining bytes went through the network.
+        QCOMPARE(client.mFeeds.first()->transferredBytes, qint64(content.size() - 100000));
+        QVERIFY(!DownloadSpool(notebookUid).isResumable());
+        QVERIFY(client.cleanUp());
+    }
+}
+
+void tst_WebCalClient::abortImport()
+{
+    mServer->setFeed(QStringLiteral("/abort.ics"), generatedFeed(0, 4000, "aborted"),
+                     "\"etag-abort\"", QByteArray());
+
+    Buteo::SyncProfile webcal(webcalProfile(QStringLiteral("webcal-abort"),
+                                            mServer->url(QStringLiteral("/abort.ics"))));
+
+    {
+        WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+        QVERIFY(client.init());
+        const QString notebookUid = client.mFeeds.first()->notebookUid;
+        // Abort once downloaded, while importing in the worker thread.
+        bool aborted = false;
+        connect(&client, &WebCalClient::syncProgressDetail, &client,
+                [&client, &aborted] (const QString &name, int detail) {
+                    Q_UNUSED(name);
+                    if (detail == Sync::SYNC_PROGRESS_FINALISING && !aborted) {
+                        aborted = true;
+                        QVERIFY(client.mImportThread);
+                        client.abortSync();
+                    }
+                });
+        QSignalSpy success(&client, &WebCalClient::success);
+        QSignalSpy error(&client, &WebCalClient::error);
+        QVERIFY(client.startSync());
+        QTRY_COMPARE_WITH_TIMEOUT(error.count(), 1, 30000);
+        QVERIFY(aborted);
+        QVERIFY(success.isEmpty());
+        QVERIFY(!client.mImportThread);
+        const Buteo::SyncResults res(client.getSyncResults());
+        QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_FAILED);
+        QCOMPARE(res.minorCode(), Buteo::SyncResults::ABORTED);
+
+        // The storage of the import is closed with it,
+        // and left as before the sync.
+        QVERIFY(!client.mStorage);
+        mKCal::ExtendedCalendar::Ptr cal(new mKCal::ExtendedCalendar(QTimeZone::utc()));
+        mKCal::ExtendedStorage::Ptr store = mKCal::ExtendedCalendar::defaultStorage(cal);
+        QVERIFY(store && store->open());
+        mKCal::Notebook::Ptr notebook = store->notebook(notebookUid);
+        QVERIFY(notebook);
+        QVERIFY(notebook->customProperty("etag").isEmpty());
+        for (const mKCal::Notebook::Ptr &other : store->notebooks()) {
+            QVERIFY(other->customProperty("staging-for").isEmpty());
+        }
+        QVERIFY(store->loadNotebookIncidences(notebookUid));
+        QVERIFY(cal->incidences(notebookUid).isEmpty());
+    }
+
+    {
+        WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+        synchronize(&client);
+        const Buteo::SyncResults res(client.getSyncResults());
+        QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+        QCOMPARE(res.targetResults().first().localItems().added, unsigned(4000));
+        QVERIFY(client.cleanUp());
+    }
+}
+
+void tst_WebCalClient::feedBudget()
+{
+    Buteo::Profile profile(QStringLiteral("webcal"), Buteo::Profile::TYPE_CLIENT);
+    {
+        // Guardrails are on by default.
+        const FeedBudget budget(profile);
+        QVERIFY(budget.maxBytes() > 0);
+        QVERIFY(budget.maxIncidences() > 0);
+        QVERIFY(budget.maxRecurrenceDates() > 0);
+        QVERIFY(budget.parseTimeout() > 0);
+    }
+    profile.setKey(QStringLiteral("maxBytes"), QStringLiteral("0"));
+    profile.setKey(QStringLiteral("maxIncidences"), QStringLiteral("5"));
+    profile.setKey(QStringLiteral("maxRecurrenceDates"), QStringLiteral("3"));
+    const FeedBudget budget(profile);
+    QCOMPARE(budget.maxBytes(), qint64(0));
+    QCOMPARE(budget.maxIncidences(), 5);
+
+    {
+        IcsStreamParser parser;
+        parser.setBudget(budget);
+        QVERIFY(parser.append(generatedFeed(0, 5, "within")));
+        QVERIFY(parser.finish());
+        QCOMPARE(parser.componentCount(), 5);
+        QCOMPARE(parser.exceededLimit(), FeedBudget::None);
+    }
+    {
+        // Stopped while streaming, at the first component too many.
+        IcsStreamParser parser;
+        parser.setBudget(budget);
+        QVERIFY(!parser.append(generatedFeed(0, 10, "over")));
+        QCOMPARE(parser.exceededLimit(), FeedBudget::Incidences);
+        QCOMPARE(parser.componentCount(), 6);
+        QVERIFY(!parser.finish());
+    }
+    {
+        IcsStreamParser parser;
+        parser.setBudget(budget);
+        QVERIFY(!parser.append("BEGIN:VCALENDAR\r\nVERSION:2.0\r\nPRODID:-//test//EN\r\n"
+                               "BEGIN:VEVENT\r\nUID:exdates\r\nDTSTART:20191001T100000Z\r\n"
+                               "RRULE:FREQ=DAILY\r\n"
+                               "EXDATE:20191002T100000Z,20191003T100000Z\r\n"
+                               "EXDATE:20191004T100000Z,20191005T100000Z\r\n"
+                               "END:VEVENT\r\nEND:VCALENDAR\r\n"));
+        QCOMPARE(parser.exceededLimit(), FeedBudget::RecurrenceDates);
+    }
+
+    const QByteArray content = generatedFeed(0, 100, "large");
+    mServer->setFeed(QStringLiteral("/sized.ics"), content, "\"etag-sized\"", QByteArray());
+    mServer->setFeed(QStringLiteral("/chunked.ics"), content, "\"etag-chunked\"", QByteArray(),
+                     FeedServer::Chunked);
+
+    Buteo::SyncProfile webcal(webcalProfile(QStringLiteral("webcal-budget")));
+    Buteo::Profile *client = webcal.clientProfile();
+    client->setKey(QStringLiteral("maxBytes"), QStringLiteral("1000"));
+    for (const QString &path : {QStringLiteral("/sized.ics"), QStringLiteral("/chunked.ics")}) {
+        client->setKey(QStringLiteral("remoteCalendar"), mServer->url(path));
+        WebCalClient webCalClient(QStringLiteral("webcal"), webcal, 0);
+        synchronize(&webCalClient);
+        const Buteo::SyncResults res(webCalClient.getSyncResults());
+        QCOMPARE(res.majorCode(), Buteo::SyncResults::SYNC_RESULT_FAILED);
+        QCOMPARE(res.minorCode(), Buteo::SyncResults::LOW_MEMORY);
+        QCOMPARE(webCalClient.mFeeds.first()->exceeded, FeedBudget::Bytes);
+        const QJsonObject stats = webCalClient.mStatistics.value(QStringLiteral("feeds"))
+            .toArray().first().toObject();
+        QCOMPARE(stats.value(QStringLiteral("exceededBudget")).toString(), QStringLiteral("maxBytes"));
+        QCOMPARE(stats.value(QStringLiteral("budget")).toDouble(), 1000.);
+        QVERIFY(webCalClient.cleanUp());
+    }
+}
+
+void tst_WebCalClient::feedRecord()
+{
+    mServer->setFeed(QStringLiteral("/recorded.ics"), icsDataFirst, "\"etag-recorded\"", QByteArray());
+
+    Buteo::SyncProfile webcal(webcalProfile(QStringLiteral("webcal-record"),
+                                            mServer->url(QStringLiteral("/recorded.ics"))));
+    Buteo::Profile *profile = webcal.clientProfile();
+    FeedRecord::remove(webcal.name());
+
+    QString notebookUid;
+    {
+        WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+        QVERIFY(client.init());
+        QVERIFY(client.mStorage);
+        notebookUid = client.mFeeds.first()->notebookUid;
+        synchronize(&client);
+        QCOMPARE(client.getSyncResults().majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+        FeedRecord record;
+        QVERIFY(record.load(webcal.name()));
+        QCOMPARE(record.entries().count(), 1);
+        QCOMPARE(record.entries().first().notebookUid, notebookUid);
+        QCOMPARE(record.entries().first().etag, QByteArray("\"etag-recorded\""));
+    }
+
+    {
+        // Conditional request sent without opening storage,
+        // the outcome is kept by the record.
+        WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+        QVERIFY(client.init());
+        QVERIFY(!client.mStorage);
+        QCOMPARE(client.mFeeds.first()->notebookUid, notebookUid);
+        QCOMPARE(client.mFeeds.first()->etag, QByteArray("\"etag-recorded\""));
+        synchronize(&client);
+        QCOMPARE(client.getSyncResults().majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+        QCOMPARE(client.mFeeds.first()->state, WebCalClient::Feed::NotModified);
+        QCOMPARE(mServer->lastHeader(QStringLiteral("/recorded.ics"), "if-none-match"),
+                 QByteArray("\"etag-recorded\""));
+        QVERIFY(!client.mStorage);
+        FeedRecord record;
+        QVERIFY(record.load(webcal.name()));
+        QVERIFY(!record.isImporting());
+        QCOMPARE(record.entries().first().unchangedSyncs, 1);
+        mKCal::ExtendedCalendar::Ptr cal(new mKCal::ExtendedCalendar(QTimeZone::utc()));
+        mKCal::ExtendedStorage::Ptr store = mKCal::ExtendedCalendar::defaultStorage(cal);
+        QVERIFY(store && store->open());
+        mKCal::Notebook::Ptr notebook = store->notebook(notebookUid);
+        QVERIFY(notebook);
+        QVERIFY(notebook->customProperty("unchanged-syncs").isEmpty());
+    }
+
+    {
+        // Modified feed, the record follows the new validators.
+        mServer->setFeed(QStringLiteral("/recorded.ics"), icsDataSecond, "\"etag-recorded2\"", QByteArray());
+        WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+        QVERIFY(client.init());
+        QVERIFY(!client.mStorage);
+        synchronize(&client);
+        QCOMPARE(client.getSyncResults().majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+        QCOMPARE(client.mFeeds.first()->state, WebCalClient::Feed::Modified);
+        FeedRecord record;
+        QVERIFY(record.load(webcal.name()));
+        QCOMPARE(record.entries().first().etag, QByteArray("\"etag-recorded2\""));
+        QCOMPARE(record.entries().first().unchangedSyncs, 0);
+        // The outcome of the unchanged sync is written with this one.
+        mKCal::ExtendedCalendar::Ptr cal(new mKCal::ExtendedCalendar(QTimeZone::utc()));
+        mKCal::ExtendedStorage::Ptr store = mKCal::ExtendedCalendar::defaultStorage(cal);
+        QVERIFY(store && store->open());
+        mKCal::Notebook::Ptr notebook = store->notebook(notebookUid);
+        QVERIFY(notebook);
+        QCOMPARE(notebook->customProperty("change-history"), record.entries().first().history);
+        QCOMPARE(record.entries().first().history.split(QLatin1Char(' ')).count(), 3);
+    }
+
+    {
+        // With a rolling window, once the window a notebook was
+        // imported with does not cover the required one anymore,
+        // it is imported again through storage.
+        profile->setKey(QStringLiteral("futureDays"), QStringLiteral("30"));
+        const QDateTime end = QDateTime::currentDateTimeUtc().addDays(1);
+        FeedRecord record;
+        QVERIFY(record.load(webcal.name()));
+        FeedRecord::Entry entry = record.entries().first();
+        entry.windowEnd = end;
+        FeedRecord stale;
+        stale.append(entry);
+        QVERIFY(stale.save(webcal.name()));
+        mKCal::ExtendedCalendar::Ptr cal(new mKCal::ExtendedCalendar(QTimeZone::utc()));
+        mKCal::ExtendedStorage::Ptr store = mKCal::ExtendedCalendar::defaultStorage(cal);
+        QVERIFY(store && store->open());
+        mKCal::Notebook::Ptr notebook = store->notebook(notebookUid);
+        QVERIFY(notebook);
+        notebook->setCustomProperty("window-end", end.toString(Qt::ISODate));
+        QVERIFY(store->updateNotebook(notebook));
+
+        WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+        QVERIFY(client.init());
+        QVERIFY(client.mStorage);
+        QVERIFY(client.mFeeds.first()->etag.isEmpty());
+        synchronize(&client);
+        QCOMPARE(client.getSyncResults().majorCode(), Buteo::SyncResults::SYNC_RESULT_SUCCESS);
+        QCOMPARE(client.mFeeds.first()->state, WebCalClient::Feed::Modified);
+        QVERIFY(record.load(webcal.name()));
+        QCOMPARE(record.entries().first().windowEnd, client.mFilter.windowEnd());
+    }
+
+    {
+        // Another filter needs the notebooks from storage.
+        profile->setKey(QStringLiteral("incidenceTypes"), QStringLiteral("event"));
+        WebCalClient client(QStringLiteral("webcal"), webcal, 0);
+        QVERIFY(client.init());
+        QVERIFY(client.mStorage);
+        QCOMPARE(client.mFeeds.first()->notebookUid, notebookUid);
+        QVERIFY(client.mFeeds.first()->etag.isEmpty());
+        QVERIFY(client.cleanUp());
+        QVERIFY(!QFile::exists(FeedRecord::path(webcal.name())));
+    }
+}
+
 #include "tst_webcalclient.moc"
 QTEST_MAIN(tst_WebCalClient)